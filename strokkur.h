@@ -1,5 +1,11 @@
 #ifndef STROKKUR_H
 #define STROKKUR_H
+#include "strokkur_budget.h"
 #include "strokkur_recv.h"
+#include "strokkur_ring.h"
 #include "strokkur_send.h"
+#include "strokkur_sha256.h"
+#include "strokkur_stream.h"
+#include "strokkur_submit.h"
+#include "strokkur_wheel.h"
 #endif /* !STROKKUR_H */
@@ -0,0 +1,264 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "strokkur_budget.h"
+#include "strokkur_list.h"
+
+#define BUDGET_LINK STROKKUR_LINK(budget_link)
+#define WHEEL_LINK STROKKUR_LINK(wheel_link)
+
+/* Ages are capped (at ~12 days) so that remaining times fit in 64 bits. */
+#define MAX_AGE_US (1ULL << 40)
+/* Nearly complete states, then one class per power of two. */
+#define EVICT_CLASSES 65
+
+int
+strokkur_budget_init(struct strokkur_budget *budget, size_t budget_bytes,
+                     size_t large_bytes, size_t reserve_bytes)
+{
+
+        memset(budget, 0, sizeof(*budget));
+        if (budget_bytes == 0) {
+                return -1;
+        }
+
+        if (reserve_bytes > budget_bytes) {
+                return -2;
+        }
+
+        for (size_t i = 0; i < STROKKUR_BUDGET_PRIORITIES; i++) {
+                budget->tails[i] = &budget->states[i];
+        }
+
+        budget->budget_bytes = budget_bytes;
+        budget->large_bytes = large_bytes;
+        budget->reserve_bytes = reserve_bytes;
+        return 0;
+}
+
+size_t
+strokkur_budget_cost(const struct strokkur_recv_state *state)
+{
+
+        return sizeof(*state) + (size_t)state->chunk_count * sizeof(struct strokkur_chunk);
+}
+
+void
+strokkur_budget_release(struct strokkur_budget *budget,
+                        struct strokkur_recv_state *state)
+{
+        struct strokkur_recv_link *node = &state->budget_link;
+
+        if (!strokkur_list_linked(state, BUDGET_LINK)) {
+                return;
+        }
+
+        if (node->next == NULL) {
+                budget->tails[state->priority] = node->pprev;
+        }
+
+        strokkur_list_remove(state, BUDGET_LINK);
+        budget->used_bytes -= state->budget_bytes;
+        budget->priority_bytes[state->priority] -= state->budget_bytes;
+        state->budget_bytes = 0;
+        return;
+}
+
+/*
+ * Is @a state nearly complete?  At the rate it has gained rank so far,
+ * its remaining time is deficit * age / rank; spare it if that is at
+ * most its age, i.e., if it has at least half its rank.
+ */
+static bool
+nearly_complete(const struct strokkur_recv_state *state)
+{
+
+        if (state->chunk_received >= state->chunk_count) {
+                return true;
+        }
+
+        return (size_t)state->chunk_count - state->chunk_received <= state->chunk_received;
+}
+
+/*
+ * Eviction class of @a state: 0 if it is nearly complete, else 1 plus
+ * the log2 of its remaining time, deficit * age / rank.  States without
+ * any rank yet are in the last class.
+ */
+static unsigned int
+evict_class(const struct strokkur_recv_state *state, uint64_t now_us)
+{
+        uint64_t age = 1;
+        uint64_t remaining;
+
+        if (nearly_complete(state)) {
+                return 0;
+        }
+
+        if (state->chunk_received == 0) {
+                return EVICT_CLASSES - 1;
+        }
+
+        if (now_us > state->first_received_us) {
+                age += now_us - state->first_received_us;
+        }
+
+        age = age < MAX_AGE_US ? age : MAX_AGE_US;
+        remaining = ((uint64_t)state->chunk_count - state->chunk_received) * age /
+                state->chunk_received;
+        return 1 + (63 - __builtin_clzll(remaining | 1));
+}
+
+static void
+evict_state(struct strokkur_budget *budget, struct strokkur_recv_state *state,
+            strokkur_chunk_recycle_fn *recycle,
+            strokkur_budget_evicted_fn *evicted, void *ctx)
+{
+
+        strokkur_budget_release(budget, state);
+        strokkur_recv_recycle(state, recycle, ctx);
+        if (evicted != NULL) {
+                evicted(ctx, state);
+        } else {
+                /* Without a callback, nothing unlinks it from a wheel. */
+                assert(!strokkur_list_linked(state, WHEEL_LINK));
+                strokkur_recv_deinit(state);
+        }
+
+        budget->evicted++;
+        return;
+}
+
+/*
+ * Evict states with priority below @a max_priority, lowest priority
+ * first.  Within a priority, states go by decreasing eviction class,
+ * i.e., largest rank deficit relative to their age first, and oldest
+ * first within a class: one walk of the admission-ordered list sizes
+ * the classes, and a second evicts the classes that must go.
+ */
+static size_t
+evict_below(struct strokkur_budget *budget, size_t n_bytes,
+            unsigned int max_priority,
+            strokkur_chunk_recycle_fn *recycle,
+            strokkur_budget_evicted_fn *evicted, void *ctx)
+{
+        uint64_t now_us = strokkur_clock_us();
+        size_t released = 0;
+        size_t ret = 0;
+
+        for (unsigned int priority = 0;
+             priority < max_priority && released < n_bytes;
+             priority++) {
+                size_t class_bytes[EVICT_CLASSES] = { 0 };
+                struct strokkur_recv_state *state;
+                unsigned int threshold;
+                size_t above = 0;
+                size_t quota;
+
+                for (state = budget->states[priority]; state != NULL;
+                     state = state->budget_link.next) {
+                        class_bytes[evict_class(state, now_us)] += state->budget_bytes;
+                }
+
+                /* Classes above threshold go; threshold, oldest first. */
+                for (threshold = EVICT_CLASSES - 1; threshold > 0; threshold--) {
+                        if (above + class_bytes[threshold] >= n_bytes - released) {
+                                break;
+                        }
+
+                        above += class_bytes[threshold];
+                }
+
+                quota = n_bytes - released > above ? n_bytes - released - above : 0;
+                state = budget->states[priority];
+                while (state != NULL && released < n_bytes) {
+                        struct strokkur_recv_state *next = state->budget_link.next;
+                        unsigned int state_class = evict_class(state, now_us);
+
+                        if (state_class > threshold || (state_class == threshold && quota > 0)) {
+                                if (state_class == threshold) {
+                                        quota -= quota < state->budget_bytes ?
+                                                quota : state->budget_bytes;
+                                }
+
+                                released += state->budget_bytes;
+                                evict_state(budget, state, recycle, evicted, ctx);
+                                ret++;
+                        }
+
+                        state = next;
+                }
+        }
+
+        return ret;
+}
+
+int
+strokkur_budget_admit(struct strokkur_budget *budget,
+                      struct strokkur_recv_state *state,
+                      unsigned int priority,
+                      strokkur_chunk_recycle_fn *recycle,
+                      strokkur_budget_evicted_fn *evicted, void *ctx)
+{
+        size_t need = strokkur_budget_cost(state);
+        size_t limit = budget->budget_bytes;
+        bool large = need > budget->large_bytes;
+
+        if (priority >= STROKKUR_BUDGET_PRIORITIES) {
+                priority = STROKKUR_BUDGET_PRIORITIES - 1;
+        }
+
+        if (large) {
+                limit -= budget->reserve_bytes;
+        }
+
+        if (need > limit) {
+                budget->refused++;
+                return -1;
+        }
+
+        if (budget->used_bytes + need > limit) {
+                size_t missing = budget->used_bytes + need - limit;
+                size_t evictable = 0;
+
+                /* Shed new large messages before committed ones. */
+                if (large) {
+                        budget->refused++;
+                        return -2;
+                }
+
+                for (unsigned int i = 0; i < priority; i++) {
+                        evictable += budget->priority_bytes[i];
+                }
+
+                if (evictable < missing) {
+                        budget->refused++;
+                        return -3;
+                }
+
+                evict_below(budget, missing, priority, recycle, evicted, ctx);
+        }
+
+        /* Append, so that each list stays in admission (age) order. */
+        strokkur_list_insert(budget->tails[priority], state, BUDGET_LINK);
+        budget->tails[priority] = &state->budget_link.next;
+        state->budget_bytes = need;
+        state->priority = priority;
+        budget->used_bytes += need;
+        budget->priority_bytes[priority] += need;
+        budget->admitted++;
+        return 0;
+}
+
+size_t
+strokkur_budget_evict(struct strokkur_budget *budget, size_t n_bytes,
+                      strokkur_chunk_recycle_fn *recycle,
+                      strokkur_budget_evicted_fn *evicted, void *ctx)
+{
+
+        return evict_below(budget, n_bytes, STROKKUR_BUDGET_PRIORITIES,
+                           recycle, evicted, ctx);
+}
@@ -0,0 +1,113 @@
+#ifndef STROKKUR_BUDGET_H
+#define STROKKUR_BUDGET_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strokkur_recv.h"
+
+/* Admission priorities run from 0 (shed first) to 3. */
+#define STROKKUR_BUDGET_PRIORITIES 4
+
+/*
+ * Bounds the memory pinned by receive states.  Each admitted state
+ * reserves its own size plus one struct strokkur_chunk per chunk of
+ * its message, which is as many chunks as the decoder ever holds for
+ * it, so admitted messages never run short.
+ *
+ * When the budget is exhausted, new large messages are refused
+ * outright; other messages may only evict states of strictly lower
+ * priority.  Within a priority, victims are the states with the
+ * largest rank deficit relative to their age (the longest remaining
+ * time at their pace so far, to within a factor of two), oldest first;
+ * nearly complete ones go last.
+ */
+struct strokkur_budget {
+        size_t budget_bytes;
+        size_t used_bytes;
+        /* Messages that reserve more than this are large. */
+        size_t large_bytes;
+        /* Large messages may not use the last reserve_bytes of the budget. */
+        size_t reserve_bytes;
+        size_t priority_bytes[STROKKUR_BUDGET_PRIORITIES];
+        /* Admitted states, oldest first, and their last next field. */
+        struct strokkur_recv_state *states[STROKKUR_BUDGET_PRIORITIES];
+        struct strokkur_recv_state **tails[STROKKUR_BUDGET_PRIORITIES];
+        /* Statistics. */
+        uint64_t admitted;
+        uint64_t refused;
+        uint64_t evicted;
+};
+
+/**
+ * @brief Called for each evicted receive state, after its chunks have
+ * been recycled.  The state is released from the budget and belongs to
+ * the callee, which should drop it from its routing table (and
+ * strokkur_wheel), then deinitialise or reuse it.
+ *
+ * @note the callback is required for states that are also tracked by a
+ * strokkur_wheel: without it, evicted states are deinitialised while
+ * still linked in the wheel (an assertion).
+ */
+typedef void strokkur_budget_evicted_fn(void *ctx, struct strokkur_recv_state *);
+
+/**
+ * @brief Initialise an empty budget of @a budget_bytes.
+ *
+ * @param large_bytes messages that reserve more are refused, rather
+ * than admitted through eviction, when the budget is exhausted.
+ * @param reserve_bytes the part of the budget only small messages may
+ * use.
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_budget_init(struct strokkur_budget *, size_t budget_bytes,
+                         size_t large_bytes, size_t reserve_bytes);
+
+/**
+ * @brief Return the number of bytes an initialised receive state
+ * reserves.
+ */
+size_t strokkur_budget_cost(const struct strokkur_recv_state *);
+
+/**
+ * @brief Admit the freshly initialised receive state @a state with
+ * @a priority (at most STROKKUR_BUDGET_PRIORITIES - 1), evicting
+ * lower-priority states if necessary and allowed.
+ *
+ * Evicted states are passed to @a recycle and @a evicted as for
+ * strokkur_budget_evict.  A refused state should be deinitialised
+ * after recycling its chunks.
+ *
+ * @return 0 if admitted, negative if refused.
+ */
+int strokkur_budget_admit(struct strokkur_budget *, struct strokkur_recv_state *state,
+                          unsigned int priority,
+                          strokkur_chunk_recycle_fn *recycle,
+                          strokkur_budget_evicted_fn *evicted, void *ctx);
+
+/**
+ * @brief Return the reservation of an admitted state, e.g., once its
+ * message has been extracted or it expired.  Releasing a state that
+ * was not admitted is a no-op.
+ *
+ * @note the state must be released before it is re-initialised or
+ * deinitialised.
+ */
+void strokkur_budget_release(struct strokkur_budget *, struct strokkur_recv_state *);
+
+/**
+ * @brief Evict admitted states, lowest priority first, until at least
+ * @a n_bytes have been released (e.g., when the chunk pool runs dry).
+ * Within a priority, states with the largest rank deficit relative to
+ * their age go first, and nearly complete ones (with at least half
+ * their rank) only as a last resort.
+ *
+ * Each evicted state's chunks are passed to @a recycle, and the state
+ * is then passed to @a evicted, or deinitialised if @a evicted is NULL
+ * (only for states not in a strokkur_wheel).
+ *
+ * @return the number of evicted states.
+ */
+size_t strokkur_budget_evict(struct strokkur_budget *, size_t n_bytes,
+                             strokkur_chunk_recycle_fn *recycle,
+                             strokkur_budget_evicted_fn *evicted, void *ctx);
+#endif /* !STROKKUR_BUDGET_H */
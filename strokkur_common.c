@@ -1,8 +1,15 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <time.h>
 #include <emmintrin.h>
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#endif
+
 #include "strokkur_common.h"
 
 static void
@@ -41,6 +48,22 @@ xor_cache_line(void *restrict acc, const void *restrict src)
         return;
 }
 
+/*
+ * Always inlined with a constant @a n_lines, so that each common size
+ * gets its own fully unrollable loop, without a tail.
+ */
+static inline __attribute__((__always_inline__)) void
+xor_cache_lines(uint8_t *restrict acc8, const uint8_t *restrict src8,
+                size_t n_lines)
+{
+
+        for (size_t i = 0; i < n_lines; i++) {
+                xor_cache_line(acc8 + 64 * i, src8 + 64 * i);
+        }
+
+        return;
+}
+
 void
 strokkur_block_xor(void *restrict acc, const void *restrict src, size_t n_bytes)
 {
@@ -48,6 +71,27 @@ strokkur_block_xor(void *restrict acc, const void *restrict src, size_t n_bytes)
         const uint8_t *src8 = src;
         size_t i, round_bytes;
 
+        _Static_assert((sizeof(((struct strokkur_chunk_header *)NULL)->mask) % 64) == 0,
+                       "Chunk masks should be whole cache lines.");
+        _Static_assert((STROKKUR_CHUNK_DATA_MAX % 64) == 0 &&
+                       (STROKKUR_CHUNK_DATA_MTU1500 % 64) == 0 &&
+                       (STROKKUR_CHUNK_DATA_MTU1500_IPV6 % 64) == 0,
+                       "Common chunk strides should be whole cache lines.");
+        switch (n_bytes) {
+#define FIXED(N)                                                \
+        case N:                                                 \
+                xor_cache_lines(acc8, src8, (N) / 64);          \
+                return
+
+        FIXED(sizeof(((struct strokkur_chunk_header *)NULL)->mask));
+        FIXED(STROKKUR_CHUNK_DATA_MTU1500_IPV6);
+        FIXED(STROKKUR_CHUNK_DATA_MTU1500);
+        FIXED(STROKKUR_CHUNK_DATA_MAX);
+#undef FIXED
+        default:
+                break;
+        }
+
         i = 0;
         round_bytes = n_bytes & ~63UL;
         if (__builtin_expect(round_bytes > 0, 1)) {
@@ -69,3 +113,247 @@ strokkur_block_xor(void *restrict acc, const void *restrict src, size_t n_bytes)
 
         return;
 }
+
+/* Reflected Castagnoli polynomial. */
+#define CRC32C_POLY 0x82f63b78U
+
+enum crc32c_op {
+        CRC32C_READ,
+        CRC32C_COPY,
+        CRC32C_XOR,
+};
+
+static uint32_t
+crc32c_byte(uint32_t crc, uint8_t byte)
+{
+
+        crc ^= byte;
+        for (size_t i = 0; i < 8; i++) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        }
+
+        return crc;
+}
+
+/*
+ * Checksum the bytes written to @a dst (read from @a src for
+ * CRC32C_READ), one byte at a time.  Only for machines without SSE4.2.
+ */
+static uint32_t
+crc32c_generic(uint8_t *dst, const uint8_t *src, size_t n_bytes,
+               uint32_t crc, enum crc32c_op op)
+{
+
+        for (size_t i = 0; i < n_bytes; i++) {
+                uint8_t byte = src[i];
+
+                if (op == CRC32C_XOR) {
+                        byte ^= dst[i];
+                }
+
+                if (op != CRC32C_READ) {
+                        dst[i] = byte;
+                }
+
+                crc = crc32c_byte(crc, byte);
+        }
+
+        return crc;
+}
+
+#ifdef __x86_64__
+#include <nmmintrin.h>
+
+/* As crc32c_generic, 8 bytes at a time with the SSE4.2 crc32 instruction. */
+__attribute__((__target__("sse4.2"))) static uint32_t
+crc32c_sse42(uint8_t *dst, const uint8_t *src, size_t n_bytes,
+             uint32_t crc, enum crc32c_op op)
+{
+        uint64_t crc64 = crc;
+        size_t i = 0;
+
+        switch (op) {
+        case CRC32C_READ:
+                for (; i + 8 <= n_bytes; i += 8) {
+                        uint64_t word;
+
+                        memcpy(&word, src + i, sizeof(word));
+                        crc64 = _mm_crc32_u64(crc64, word);
+                }
+
+                break;
+        case CRC32C_COPY:
+                for (; i + 8 <= n_bytes; i += 8) {
+                        uint64_t word;
+
+                        memcpy(&word, src + i, sizeof(word));
+                        memcpy(dst + i, &word, sizeof(word));
+                        crc64 = _mm_crc32_u64(crc64, word);
+                }
+
+                break;
+        case CRC32C_XOR:
+                for (; i + 8 <= n_bytes; i += 8) {
+                        uint64_t word, acc;
+
+                        memcpy(&word, src + i, sizeof(word));
+                        memcpy(&acc, dst + i, sizeof(acc));
+                        word ^= acc;
+                        memcpy(dst + i, &word, sizeof(word));
+                        crc64 = _mm_crc32_u64(crc64, word);
+                }
+
+                break;
+        }
+
+        return crc32c_generic(dst == NULL ? NULL : dst + i, src + i,
+                              n_bytes - i, crc64, op);
+}
+#endif
+
+/* The usual pre- and post-conditioning, as in zlib's crc32. */
+static uint32_t
+crc32c_pass(uint8_t *dst, const uint8_t *src, size_t n_bytes,
+            uint32_t crc, enum crc32c_op op)
+{
+
+#ifdef __x86_64__
+        if (__builtin_expect(__builtin_cpu_supports("sse4.2"), 1)) {
+                return ~crc32c_sse42(dst, src, n_bytes, ~crc, op);
+        }
+#endif
+
+        return ~crc32c_generic(dst, src, n_bytes, ~crc, op);
+}
+
+uint32_t
+strokkur_crc32c(uint32_t crc, const void *data, size_t n_bytes)
+{
+
+        return crc32c_pass(NULL, data, n_bytes, crc, CRC32C_READ);
+}
+
+uint32_t
+strokkur_block_copy_crc32c(void *restrict dst, const void *restrict src,
+                           size_t n_bytes, uint32_t crc)
+{
+
+        return crc32c_pass(dst, src, n_bytes, crc, CRC32C_COPY);
+}
+
+uint32_t
+strokkur_block_xor_crc32c(void *restrict acc, const void *restrict src,
+                          size_t n_bytes, uint32_t crc)
+{
+
+        return crc32c_pass(acc, src, n_bytes, crc, CRC32C_XOR);
+}
+
+uint32_t
+strokkur_chunk_crc32c(const struct strokkur_chunk_header *header, uint32_t data_crc)
+{
+        struct strokkur_chunk_header copy;
+
+        memcpy(&copy, header, sizeof(copy));
+        copy.crc32c = 0;
+        return strokkur_crc32c(data_crc, &copy, sizeof(copy));
+}
+
+#ifdef CLOCK_REALTIME_COARSE
+#define STROKKUR_COARSE_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define STROKKUR_COARSE_CLOCK CLOCK_REALTIME
+#endif
+
+uint64_t
+strokkur_clock_us(void)
+{
+        struct timespec now;
+
+        /* The coarse clocks are read from the vDSO, without a fence. */
+        if (clock_gettime(STROKKUR_COARSE_CLOCK, &now) != 0) {
+                return 0;
+        }
+
+        return (uint64_t)now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+
+#ifdef SO_TIMESTAMPING
+int
+strokkur_timestamping_enable(int fd, bool hardware)
+{
+        int flags;
+
+        flags = SOF_TIMESTAMPING_SOFTWARE;
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE;
+        /* Number sends, rather than loop each datagram back to the error queue. */
+        flags |= SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (hardware) {
+                flags |= SOF_TIMESTAMPING_RAW_HARDWARE;
+                flags |= SOF_TIMESTAMPING_RX_HARDWARE;
+                flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+        }
+
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                       &flags, sizeof(flags)) != 0) {
+                return -1;
+        }
+
+        return 0;
+}
+
+static uint64_t
+timespec_us(const struct timespec *ts)
+{
+
+        return (uint64_t)ts->tv_sec * 1000000UL + ts->tv_nsec / 1000;
+}
+
+int
+strokkur_timestamp_cmsg(const struct msghdr *message,
+                        uint64_t *software_us, uint64_t *hardware_us)
+{
+
+        *software_us = 0;
+        *hardware_us = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR((struct msghdr *)message, cmsg)) {
+                struct scm_timestamping ts;
+
+                if (cmsg->cmsg_level != SOL_SOCKET ||
+                    cmsg->cmsg_type != SCM_TIMESTAMPING ||
+                    cmsg->cmsg_len < CMSG_LEN(sizeof(ts))) {
+                        continue;
+                }
+
+                /* ts.ts[1] is deprecated; unset stamps are zero. */
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                *software_us = timespec_us(&ts.ts[0]);
+                *hardware_us = timespec_us(&ts.ts[2]);
+                return (*software_us != 0 || *hardware_us != 0) ? 0 : -1;
+        }
+
+        return -1;
+}
+#else
+int
+strokkur_timestamping_enable(int fd, bool hardware)
+{
+
+        (void)fd;
+        (void)hardware;
+        return -1;
+}
+
+int
+strokkur_timestamp_cmsg(const struct msghdr *message,
+                        uint64_t *software_us, uint64_t *hardware_us)
+{
+
+        (void)message;
+        *software_us = 0;
+        *hardware_us = 0;
+        return -1;
+}
+#endif
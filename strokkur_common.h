@@ -1,15 +1,38 @@
 #ifndef STROKKUR_COMMON_H
 #define STROKKUR_COMMON_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/socket.h>
 #include <uuid/uuid.h>
 
 /* A strokkur message may be composed of at most 512 chunks. */
 #define STROKKUR_CHUNK_MAX 512UL
 /* A strokkur chunk may have at most 8K bytes of data. */
 #define STROKKUR_CHUNK_DATA_MAX 8192UL
+/* The largest chunks that fit in a 1500 byte MTU, for IPv4 and IPv6. */
+#define STROKKUR_CHUNK_DATA_MTU1500 1280UL
+#define STROKKUR_CHUNK_DATA_MTU1500_IPV6 1216UL
 
-/* The header is little endian on the wire. */
+/*
+ * Version of the wire format, in every chunk header.  Version 2 (the
+ * first to carry it) added every field after the mask.
+ */
+#define STROKKUR_WIRE_VERSION 2
+
+/* The chunk is part of a stream (see strokkur_stream.h). */
+#define STROKKUR_CHUNK_STREAM 0x1U
+/* The chunk's generation is the last in its stream. */
+#define STROKKUR_CHUNK_STREAM_LAST 0x2U
+/* The chunk carries a CRC32C of its payload and header. */
+#define STROKKUR_CHUNK_CRC32C 0x4U
+
+/*
+ * The header is little endian on the wire.  It is padded to three
+ * cache lines so that payloads, which follow the header in
+ * struct strokkur_chunk, start on a cache line (see
+ * strokkur_block_xor); that leaves room for future fields.
+ */
 struct strokkur_chunk_header {
         uint64_t send_timestamp_us;
         uuid_t message_id;
@@ -18,9 +41,82 @@ struct strokkur_chunk_header {
         uint16_t chunk_count;
         uint16_t chunk_bytes;
         uint32_t mask[(STROKKUR_CHUNK_MAX + 31) / 32];
+        /* Index of the message in its stream, 0 outside streams. */
+        uint32_t generation;
+        uint32_t flags;
+        /* With STROKKUR_CHUNK_CRC32C, see strokkur_chunk_crc32c. */
+        uint32_t crc32c;
+        /* Data bytes in every base chunk but the last, at most STROKKUR_CHUNK_DATA_MAX. */
+        uint16_t chunk_stride;
+        /* STROKKUR_WIRE_VERSION; receivers reject other versions. */
+        uint16_t version;
+        uint8_t reserved[48];
 };
 
 _Static_assert((sizeof(struct strokkur_chunk_header) % 64) == 0, "Strokkur chunk header should be aligned to a cache line.");
 
+/**
+ * @brief Compute @a acc ^= @a src over @a n_bytes.
+ *
+ * Chunk masks and the usual chunk strides (STROKKUR_CHUNK_DATA_MAX,
+ * STROKKUR_CHUNK_DATA_MTU1500, and STROKKUR_CHUNK_DATA_MTU1500_IPV6)
+ * have dedicated fixed-size loops.
+ */
 void strokkur_block_xor(void *acc, const void *src, size_t n_bytes);
+
+/**
+ * @brief Extend the CRC32C @a crc (0 initially) with @a n_bytes of
+ * @a data.  Uses the SSE4.2 crc32 instruction when available.
+ */
+uint32_t strokkur_crc32c(uint32_t crc, const void *data, size_t n_bytes);
+
+/**
+ * @brief Copy @a n_bytes from @a src to @a dst, and extend the CRC32C
+ * @a crc with them, in one pass.
+ */
+uint32_t strokkur_block_copy_crc32c(void *dst, const void *src, size_t n_bytes, uint32_t crc);
+
+/**
+ * @brief Compute @a acc ^= @a src over @a n_bytes, and extend the
+ * CRC32C @a crc with the result, in one pass.
+ */
+uint32_t strokkur_block_xor_crc32c(void *acc, const void *src, size_t n_bytes, uint32_t crc);
+
+/**
+ * @brief Return the checksum for a chunk: @a data_crc, the CRC32C of
+ * the chunk's header.chunk_bytes of data, extended with @a header
+ * (with its crc32c field zeroed).
+ */
+uint32_t strokkur_chunk_crc32c(const struct strokkur_chunk_header *header, uint32_t data_crc);
+
+/**
+ * @brief Return the coarse wall-clock time (CLOCK_REALTIME_COARSE,
+ * i.e., as of the last tick), in microseconds.
+ *
+ * This is much cheaper than gettimeofday, so strokkur reads it rather
+ * than the precise time for each new message.
+ */
+uint64_t strokkur_clock_us(void);
+
+/**
+ * @brief Enable kernel (and, if @a hardware, NIC) timestamping of
+ * datagrams sent and received on socket @a fd.
+ *
+ * Hardware timestamps also require the NIC to be configured with
+ * SIOCSHWTSTAMP, and are in the NIC's clock domain.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_timestamping_enable(int fd, bool hardware);
+
+/**
+ * @brief Find the SCM_TIMESTAMPING control message in @a message, and
+ * store its software timestamp (CLOCK_REALTIME, like send timestamps)
+ * in @a software_us and its hardware timestamp (the NIC's clock) in
+ * @a hardware_us, in microseconds, or 0 for missing ones.
+ *
+ * @return 0 if there is at least one timestamp, negative otherwise.
+ */
+int strokkur_timestamp_cmsg(const struct msghdr *message,
+                            uint64_t *software_us, uint64_t *hardware_us);
 #endif /* !STROKKUR_COMMON_H */
@@ -0,0 +1,77 @@
+#ifndef STROKKUR_LIST_H
+#define STROKKUR_LIST_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "strokkur_recv.h"
+
+/*
+ * Internal: intrusive doubly linked lists of receive states, threaded
+ * through one of their struct strokkur_recv_link members, which is
+ * identified by its offset (STROKKUR_LINK).  A list is a pointer to
+ * its first state; a state's pprev points to the head, or to the
+ * previous state's next field.
+ */
+#define STROKKUR_LINK(FIELD) offsetof(struct strokkur_recv_state, FIELD)
+
+static inline struct strokkur_recv_link *
+strokkur_list_link(struct strokkur_recv_state *state, size_t link)
+{
+
+        return (struct strokkur_recv_link *)((char *)state + link);
+}
+
+static inline bool
+strokkur_list_linked(struct strokkur_recv_state *state, size_t link)
+{
+
+        return strokkur_list_link(state, link)->pprev != NULL;
+}
+
+/* Link @a state at @a pprev: a list head, or a state's next field. */
+static inline void
+strokkur_list_insert(struct strokkur_recv_state **pprev,
+                     struct strokkur_recv_state *state, size_t link)
+{
+        struct strokkur_recv_link *node = strokkur_list_link(state, link);
+
+        node->next = *pprev;
+        node->pprev = pprev;
+        if (*pprev != NULL) {
+                strokkur_list_link(*pprev, link)->pprev = &node->next;
+        }
+
+        *pprev = state;
+        return;
+}
+
+static inline void
+strokkur_list_remove(struct strokkur_recv_state *state, size_t link)
+{
+        struct strokkur_recv_link *node = strokkur_list_link(state, link);
+
+        if (node->next != NULL) {
+                strokkur_list_link(node->next, link)->pprev = node->pprev;
+        }
+
+        *node->pprev = node->next;
+        node->next = NULL;
+        node->pprev = NULL;
+        return;
+}
+
+/* Move the list at @a from to the empty head @a to. */
+static inline void
+strokkur_list_move(struct strokkur_recv_state **from,
+                   struct strokkur_recv_state **to, size_t link)
+{
+
+        *to = *from;
+        *from = NULL;
+        if (*to != NULL) {
+                strokkur_list_link(*to, link)->pprev = to;
+        }
+
+        return;
+}
+#endif /* !STROKKUR_LIST_H */
@@ -3,30 +3,102 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/uio.h>
+#include <time.h>
 
 #include "strokkur_recv.h"
 
+/* Decode in column blocks when the whole message does not fit in L2. */
+#define STROKKUR_DECODE_CACHE_BYTES (256UL * 1024)
+#define STROKKUR_DECODE_BLOCK_BYTES 1024UL
+
+int
+strokkur_recv_check_header(const struct strokkur_chunk_header *header,
+                           size_t datagram_bytes)
+{
+        size_t last_word;
+        uint32_t used = 0;
+
+        /* Peers with another wire format, including older headers. */
+        if (datagram_bytes < sizeof(*header) ||
+            header->version != STROKKUR_WIRE_VERSION) {
+                return -10;
+        }
+
+        if (datagram_bytes != sizeof(*header) + header->chunk_bytes) {
+                return -3;
+        }
+
+        if (header->message_bytes < header->chunk_bytes) {
+                return -4;
+        }
+
+        if (header->chunk_count == 0 || header->chunk_count > STROKKUR_CHUNK_MAX) {
+                return -5;
+        }
+
+        if (header->message_bytes <= ((size_t)header->chunk_count - 1) * header->chunk_stride) {
+                return -6;
+        }
+
+        if (header->message_bytes > ((size_t)header->chunk_count - 1) * header->chunk_stride + header->chunk_bytes) {
+                return -7;
+        }
+
+        if (header->chunk_stride == 0 ||
+            header->chunk_stride > STROKKUR_CHUNK_DATA_MAX ||
+            header->chunk_bytes > header->chunk_stride) {
+                return -8;
+        }
+
+        /*
+         * The mask names the chunks XORed into this one: at least one,
+         * and none past chunk_count, or backsolving reaches rows that
+         * no chunk will ever fill.
+         */
+        last_word = (header->chunk_count - 1) / 32;
+        for (size_t word = 0; word < sizeof(header->mask) / sizeof(header->mask[0]); word++) {
+                used |= header->mask[word];
+                if (word > last_word && header->mask[word] != 0) {
+                        return -11;
+                }
+        }
+
+        if (used == 0 ||
+            (header->mask[last_word] >> ((header->chunk_count - 1) % 32) >> 1) != 0) {
+                return -11;
+        }
+
+        return 0;
+}
+
 int
 strokkur_recv_chunk(int fd,
                     struct sockaddr_storage *source,
                     struct strokkur_chunk *chunk)
 {
+        const size_t wire_bytes = sizeof(chunk->header) + sizeof(chunk->data);
+        size_t padded_bytes;
         struct iovec iov[1];
         struct msghdr header;
+        union {
+                struct cmsghdr align;
+                char buf[CMSG_SPACE(3 * sizeof(struct timespec))];
+        } control;
         ssize_t ret;
 
         memset(&header, 0, sizeof(header));
         memset(&iov, 0, sizeof(iov));
 
         iov[0].iov_base = chunk;
-        iov[0].iov_len = sizeof(*chunk);
+        iov[0].iov_len = wire_bytes;
 
         header.msg_name = source;
         header.msg_namelen = sizeof(*source);
         header.msg_iov = iov;
         header.msg_iovlen = 1;
+        header.msg_control = &control;
+        header.msg_controllen = sizeof(control);
 
         memset(source, 0, sizeof(*source));
         memset(chunk, 0, sizeof(chunk->header));
@@ -41,37 +113,31 @@ strokkur_recv_chunk(int fd,
         }
 
         {
-                size_t expected_bytes = sizeof(chunk->header) + chunk->header.chunk_bytes;
+                int r;
 
-                if ((size_t)ret != expected_bytes) {
-                        return -3;
+                r = strokkur_recv_check_header(&chunk->header, ret);
+                if (r != 0) {
+                        return r;
                 }
         }
 
-        if (chunk->header.message_bytes < ret) {
-                return -3;
-        }
-
-        if (chunk->header.message_bytes < chunk->header.chunk_bytes) {
-                return -4;
-        }
-
-        if (chunk->header.chunk_count == 0 || chunk->header.chunk_count > STROKKUR_CHUNK_MAX) {
-                return -5;
-        }
-
-        if (chunk->header.message_bytes <= (chunk->header.chunk_count - 1) * STROKKUR_CHUNK_DATA_MAX) {
-                return -6;
-        }
+        if ((chunk->header.flags & STROKKUR_CHUNK_CRC32C) != 0) {
+                uint32_t crc;
 
-        if (chunk->header.message_bytes > (chunk->header.chunk_count - 1) * STROKKUR_CHUNK_DATA_MAX + chunk->header.chunk_bytes) {
-                return -7;
+                crc = strokkur_crc32c(0, chunk->data, chunk->header.chunk_bytes);
+                if (strokkur_chunk_crc32c(&chunk->header, crc) != chunk->header.crc32c) {
+                        return -9;
+                }
         }
 
-        if ((size_t)ret < sizeof(*chunk)) {
-                memset((char *)chunk + ret, 0, sizeof(*chunk) - ret);
+        /* Elimination reads whole strides. */
+        padded_bytes = sizeof(chunk->header) + chunk->header.chunk_stride;
+        if ((size_t)ret < padded_bytes) {
+                memset((char *)chunk + ret, 0, padded_bytes - ret);
         }
 
+        (void)strokkur_timestamp_cmsg(&header, &chunk->received_us,
+                                      &chunk->received_hw_us);
         return 0;
 }
 
@@ -80,15 +146,9 @@ strokkur_recv_init(struct strokkur_recv_state *state,
                    const struct sockaddr_storage *source,
                    const struct strokkur_chunk *chunk)
 {
-        struct timeval now;
 
         memset(state, 0, sizeof(*state));
-        if (gettimeofday(&now, NULL) != 0) {
-                assert(0 && "gettimeofday failed");
-                memset(&now, 0, sizeof(now));
-        }
-
-        state->first_received_us = ((uint64_t)now.tv_sec * 1000000UL) + now.tv_usec;
+        state->first_received_us = strokkur_clock_us();
         memcpy(&state->source, source, sizeof(state->source));
         state->send_timestamp_us = chunk->header.send_timestamp_us;
         memcpy(&state->message_id, &chunk->header.message_id,
@@ -96,7 +156,10 @@ strokkur_recv_init(struct strokkur_recv_state *state,
         memcpy(&state->hash, &chunk->header.hash,
                sizeof(state->hash));
         state->message_bytes = chunk->header.message_bytes;
+        state->generation = chunk->header.generation;
+        state->flags = chunk->header.flags;
         state->chunk_count = chunk->header.chunk_count;
+        state->chunk_stride = chunk->header.chunk_stride;
         return;
 }
 
@@ -115,6 +178,31 @@ strokkur_recv_deinit(struct strokkur_recv_state *state)
         return;
 }
 
+void
+strokkur_recv_recycle(struct strokkur_recv_state *state,
+                      strokkur_chunk_recycle_fn *recycle, void *ctx)
+{
+
+        for (size_t i = 0; i < STROKKUR_CHUNK_MAX; i++) {
+                struct strokkur_chunk *chunk = state->chunks[i];
+
+                if (chunk == NULL) {
+                        continue;
+                }
+
+                state->chunks[i] = NULL;
+                recycle(ctx, chunk);
+        }
+
+        return;
+}
+
+/*
+ * Elimination only works on masks: each stored chunk keeps its payload
+ * as received, and its recipe records which stored payloads XOR to the
+ * payload of its reduced row.  decode applies the payload XORs once the
+ * message has full rank, so redundant chunks never touch their data.
+ */
 static void
 subtract_row(const struct strokkur_recv_state *state,
              struct strokkur_chunk *chunk,
@@ -124,34 +212,10 @@ subtract_row(const struct strokkur_recv_state *state,
 
         strokkur_block_xor(chunk->header.mask, base->header.mask,
                            sizeof(chunk->header.mask));
-        strokkur_block_xor(chunk->data, base->data, sizeof(chunk->data));
+        strokkur_block_xor(chunk->recipe, base->recipe, sizeof(chunk->recipe));
         return;
 }
 
-static struct strokkur_chunk *
-process_basis(struct strokkur_recv_state *state,
-              struct strokkur_chunk *chunk,
-              size_t row_index)
-{
-        struct strokkur_chunk *ret;
-
-        if (state->chunks[row_index] == NULL) {
-                state->chunk_received++;
-                state->chunks[row_index] = chunk;
-                return NULL;
-        }
-
-        if (memcmp(chunk->header.mask, state->chunks[row_index]->header.mask,
-                   sizeof(chunk->header.mask)) == 0) {
-                return chunk;
-        }
-
-        ret = state->chunks[row_index];
-        state->chunks[row_index] = chunk;
-        subtract_row(state, ret, row_index);
-        return ret;
-}
-
 static struct strokkur_chunk *
 process_row(struct strokkur_recv_state *state,
             struct strokkur_chunk *chunk,
@@ -161,23 +225,13 @@ process_row(struct strokkur_recv_state *state,
         size_t shift = row_index % 32;
 
         if (state->chunks[row_index] == NULL) {
-                state->chunk_received++;
+                /* The slot was empty, so no recipe refers to it yet. */
+                chunk->recipe[word] |= 1UL << shift;
+                state->order[state->chunk_received++] = row_index;
                 state->chunks[row_index] = chunk;
                 return NULL;
         }
 
-        /* XXX: We should do the popcount while we xor chunk out. */
-        if (chunk->header.mask[word] == (1UL << shift)) {
-                uint32_t base_mask[STROKKUR_CHUNK_MAX / 32];
-
-                memset(base_mask, 0, sizeof(base_mask));
-                base_mask[word] |= 1UL << shift;
-                /* Are we there yet? */
-                if (memcmp(base_mask, chunk->header.mask, sizeof(base_mask)) == 0) {
-                        return process_basis(state, chunk, row_index);
-                }
-        }
-
         subtract_row(state, chunk, row_index);
         return chunk;
 }
@@ -198,42 +252,142 @@ process_rows(struct strokkur_recv_state *state,
         return chunk;
 }
 
-int
-strokkur_recv_add_chunk(struct strokkur_recv_state *state,
-                        const struct sockaddr_storage *source,
-                        struct strokkur_chunk **chunk_p)
+static void
+note_arrival(struct strokkur_recv_state *state,
+             uint64_t software_us, uint64_t hardware_us)
+{
+        struct strokkur_recv_stats *stats = &state->stats;
+        uint64_t arrival;
+
+        /* Never mix clocks: stick to the first stamped chunk's. */
+        if (stats->arrivals == 0) {
+                stats->hardware = (software_us == 0);
+        }
+
+        arrival = stats->hardware ? hardware_us : software_us;
+        if (arrival == 0) {
+                return;
+        }
+
+        if (stats->arrivals++ == 0) {
+                stats->first_arrival_us = arrival;
+                stats->last_arrival_us = arrival;
+                return;
+        }
+
+        if (arrival > stats->last_arrival_us) {
+                uint64_t gap = arrival - stats->last_arrival_us;
+                uint64_t variation;
+
+                if (gap > stats->max_gap_us) {
+                        stats->max_gap_us = gap;
+                }
+
+                if (stats->arrivals > 2) {
+                        variation = (gap > stats->last_gap_us)
+                                ? gap - stats->last_gap_us
+                                : stats->last_gap_us - gap;
+                        /* V += (|D| - V) / 16 */
+                        stats->gap_variation_us +=
+                                ((int64_t)variation - (int64_t)stats->gap_variation_us) / 16;
+                }
+
+                stats->last_gap_us = gap;
+                stats->last_arrival_us = arrival;
+        }
+
+        if (arrival < stats->first_arrival_us) {
+                stats->first_arrival_us = arrival;
+        }
+
+        return;
+}
+
+/*
+ * Measure the lag of the chunk that completed the message, received
+ * at @a software_us: only one clock read per message.
+ */
+static void
+note_completion(struct strokkur_recv_state *state, uint64_t software_us)
+{
+        struct timespec now;
+        uint64_t now_us;
+
+        if (software_us == 0 || clock_gettime(CLOCK_REALTIME, &now) != 0) {
+                return;
+        }
+
+        now_us = (uint64_t)now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+        if (now_us > software_us) {
+                state->stats.completion_lag_us = now_us - software_us;
+        }
+
+        return;
+}
+
+/* Does the chunk with @a header belong to the message in @a state? */
+static int
+check_message(const struct strokkur_recv_state *state,
+              const struct sockaddr_storage *source,
+              const struct strokkur_chunk_header *header)
 {
-        struct strokkur_chunk *chunk = *chunk_p;
-        size_t n_word = ((size_t)state->chunk_count + 31) / 32;
 
         if (memcmp(&state->source, source, sizeof(state->source)) != 0) {
                 return -1;
         }
 
-        if (state->send_timestamp_us != chunk->header.send_timestamp_us) {
+        if (state->send_timestamp_us != header->send_timestamp_us) {
                 return -2;
         }
 
-        if (uuid_compare(state->message_id, chunk->header.message_id) != 0) {
+        if (uuid_compare(state->message_id, header->message_id) != 0) {
                 return -3;
         }
 
-        if (memcmp(state->hash, chunk->header.hash, sizeof(state->hash)) != 0) {
+        if (memcmp(state->hash, header->hash, sizeof(state->hash)) != 0) {
                 return -4;
         }
 
-        if (state->message_bytes != chunk->header.message_bytes) {
+        if (state->message_bytes != header->message_bytes) {
                 return -5;
         }
 
-        if (state->chunk_count != chunk->header.chunk_count) {
+        if (state->chunk_count != header->chunk_count ||
+            state->chunk_stride != header->chunk_stride) {
                 return -6;
         }
 
-        if (state->chunk_received > state->chunk_count) {
+        if (state->generation != header->generation ||
+            state->flags != header->flags) {
+                return -7;
+        }
+
+        return 0;
+}
+
+int
+strokkur_recv_add_chunk(struct strokkur_recv_state *state,
+                        const struct sockaddr_storage *source,
+                        struct strokkur_chunk **chunk_p)
+{
+        struct strokkur_chunk *chunk = *chunk_p;
+        size_t n_word = ((size_t)state->chunk_count + 31) / 32;
+        uint64_t received_us = chunk->received_us;
+        int r;
+
+        r = check_message(state, source, &chunk->header);
+        if (r != 0) {
+                return r;
+        }
+
+        note_arrival(state, chunk->received_us, chunk->received_hw_us);
+
+        /* Full rank: every further chunk is redundant. */
+        if (state->chunk_received >= state->chunk_count) {
                 return 0;
         }
 
+        memset(chunk->recipe, 0, sizeof(chunk->recipe));
         for (size_t word = 0; word < n_word; word++) {
                 if (chunk->header.mask[word] == 0) {
                         continue;
@@ -250,29 +404,150 @@ strokkur_recv_add_chunk(struct strokkur_recv_state *state,
                 return state->chunk_count - state->chunk_received;
         }
 
+        note_completion(state, received_us);
         return 0;
 
 }
 
+/*
+ * Is a chunk with @a header certainly redundant?  That's the case
+ * once the message has full rank, or for copies of a basis row we
+ * already have.
+ */
+static bool
+redundant_header(const struct strokkur_recv_state *state,
+                 const struct strokkur_chunk_header *header)
+{
+        size_t n_word = ((size_t)state->chunk_count + 31) / 32;
+        size_t row = SIZE_MAX;
+
+        if (state->chunk_received >= state->chunk_count) {
+                return true;
+        }
+
+        for (size_t word = 0; word < n_word; word++) {
+                uint32_t bits = header->mask[word];
+
+                if (bits == 0) {
+                        continue;
+                }
+
+                if ((bits & (bits - 1)) != 0 || row != SIZE_MAX) {
+                        return false;
+                }
+
+                row = 32 * word + __builtin_ctz(bits);
+        }
+
+        if (row == SIZE_MAX || state->chunks[row] == NULL) {
+                return false;
+        }
+
+        return memcmp(header->mask, state->chunks[row]->header.mask,
+                      sizeof(header->mask)) == 0;
+}
+
+int
+strokkur_recv_add_view(struct strokkur_recv_state *state,
+                       const struct sockaddr_storage *source,
+                       const struct strokkur_chunk_view *view,
+                       struct strokkur_chunk **chunk_p)
+{
+        struct strokkur_chunk *chunk = *chunk_p;
+        size_t chunk_bytes = view->header.chunk_bytes;
+        int r;
+
+        r = check_message(state, source, &view->header);
+        if (r != 0) {
+                return r;
+        }
+
+        if (redundant_header(state, &view->header)) {
+                note_arrival(state, view->received_us, view->received_hw_us);
+                if (state->chunk_count > state->chunk_received) {
+                        return state->chunk_count - state->chunk_received;
+                }
+
+                return 0;
+        }
+
+        if ((view->header.flags & STROKKUR_CHUNK_CRC32C) != 0) {
+                uint32_t crc;
+
+                /* Verify the payload as we copy it out of the ring. */
+                crc = strokkur_block_copy_crc32c(chunk->data, view->data, chunk_bytes, 0);
+                if (strokkur_chunk_crc32c(&view->header, crc) != view->header.crc32c) {
+                        return -9;
+                }
+        } else {
+                memcpy(chunk->data, view->data, chunk_bytes);
+        }
+
+        memcpy(&chunk->header, &view->header, sizeof(chunk->header));
+        memset(chunk->data + chunk_bytes, 0, state->chunk_stride - chunk_bytes);
+        chunk->received_us = view->received_us;
+        chunk->received_hw_us = view->received_hw_us;
+        return strokkur_recv_add_chunk(state, source, chunk_p);
+}
+
 bool
 strokkur_recv_ready(const struct strokkur_recv_state *state)
 {
 
-        return (state->chunk_received > state->chunk_count);
+        return (state->chunk_received >= state->chunk_count);
+}
+
+int64_t
+strokkur_recv_one_way_delay_us(const struct strokkur_recv_state *state)
+{
+
+        if (state->stats.arrivals == 0 || state->stats.hardware) {
+                return 0;
+        }
+
+        return (int64_t)(state->stats.first_arrival_us - state->send_timestamp_us);
 }
 
+/*
+ * Rebuild the payload of every reduced row from its recipe, latest
+ * row first: a recipe only refers to rows stored before its own, which
+ * still hold their payload as received.
+ */
 static void
-backsolve(struct strokkur_recv_state *state)
+combine_rows(struct strokkur_recv_state *state, size_t offset, size_t n_bytes)
 {
-        size_t chunk_count = state->chunk_count;
+        size_t n_word = ((size_t)state->chunk_count + 31) / 32;
 
-        assert(state->chunk_received >= state->chunk_count);
-        if (state->chunk_received != state->chunk_count) {
-                return;
+        for (size_t k = state->chunk_count; k --> 0;) {
+                size_t i = state->order[k];
+                struct strokkur_chunk *chunk = state->chunks[i];
+
+                for (size_t word = 0; word < n_word; word++) {
+                        uint32_t bits = chunk->recipe[word];
+
+                        if (word == i / 32) {
+                                bits &= ~(1UL << (i % 32));
+                        }
+
+                        for (; bits != 0; bits &= bits - 1) {
+                                size_t j = 32 * word + __builtin_ctz(bits);
+
+                                strokkur_block_xor(chunk->data + offset,
+                                                   state->chunks[j]->data + offset,
+                                                   n_bytes);
+                        }
+                }
         }
 
+        return;
+}
+
+static void
+backsolve(struct strokkur_recv_state *state, size_t offset, size_t n_bytes)
+{
+        size_t chunk_count = state->chunk_count;
+
         for (size_t i = chunk_count; i --> 0;) {
-                size_t chunk_size = state->chunks[i]->header.chunk_bytes;
                 size_t word = i / 32;
                 size_t shift = i % 32;
                 uint32_t mask = 1UL << shift;
@@ -282,10 +557,43 @@ backsolve(struct strokkur_recv_state *state)
                                 continue;
                         }
 
-                        strokkur_block_xor(state->chunks[j]->data,
-                                           state->chunks[i]->data,
-                                           chunk_size);
+                        strokkur_block_xor(state->chunks[j]->data + offset,
+                                           state->chunks[i]->data + offset,
+                                           n_bytes);
+                }
+        }
+
+        return;
+}
+
+/*
+ * Apply the deferred payload XORs, one column block at a time so that
+ * both passes over a block stay in cache.
+ */
+static void
+decode(struct strokkur_recv_state *state)
+{
+        size_t stride = state->chunk_stride;
+        size_t block_bytes = stride;
+
+        assert(state->chunk_received >= state->chunk_count);
+        if (state->chunk_received != state->chunk_count) {
+                return;
+        }
+
+        if (stride * state->chunk_count > STROKKUR_DECODE_CACHE_BYTES) {
+                block_bytes = STROKKUR_DECODE_BLOCK_BYTES;
+        }
+
+        for (size_t offset = 0; offset < stride; offset += block_bytes) {
+                size_t n_bytes = stride - offset;
+
+                if (n_bytes > block_bytes) {
+                        n_bytes = block_bytes;
                 }
+
+                combine_rows(state, offset, n_bytes);
+                backsolve(state, offset, n_bytes);
         }
 
         state->chunk_received = UINT16_MAX;
@@ -303,7 +611,7 @@ strokkur_recv_extract(struct strokkur_recv_state *state,
                 return -1;
         }
 
-        if (state->chunk_count * STROKKUR_CHUNK_DATA_MAX < state->message_bytes) {
+        if (state->chunk_count * (size_t)state->chunk_stride < state->message_bytes) {
                 return -2;
         }
 
@@ -311,14 +619,14 @@ strokkur_recv_extract(struct strokkur_recv_state *state,
                 return state->message_bytes;
         }
 
-        backsolve(state);
+        decode(state);
         if (bufsz > state->message_bytes) {
                 bufsz = state->message_bytes;
         }
 
         for (size_t i = 0; i < state->chunk_count; i++) {
                 size_t remaining = bufsz - written;
-                size_t to_read = STROKKUR_CHUNK_DATA_MAX;
+                size_t to_read = state->chunk_stride;
 
                 if (remaining == 0) {
                         break;
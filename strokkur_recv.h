@@ -12,38 +12,125 @@
 struct strokkur_chunk {
         struct strokkur_chunk_header header;
         uint8_t data[STROKKUR_CHUNK_DATA_MAX];
+        /* Local metadata, not sent on the wire. */
+        /* Receive timestamps, 0 if none; see strokkur_timestamp_cmsg. */
+        uint64_t received_us;
+        uint64_t received_hw_us;
+        /* Stored rows whose payloads XOR to this reduced row. */
+        uint32_t recipe[STROKKUR_CHUNK_MAX / 32];
+};
+
+/*
+ * A chunk that is still in a receive buffer owned by someone else,
+ * e.g., a struct strokkur_ring.  The header is copied out, the payload
+ * is not.
+ */
+struct strokkur_chunk_view {
+        struct strokkur_chunk_header header;
+        const uint8_t *data; /* header.chunk_bytes of payload. */
+        uint64_t received_us;
+        uint64_t received_hw_us;
+};
+
+/*
+ * Arrival statistics for the chunks of one message, from kernel
+ * receive timestamps, or NIC timestamps for chunks that only have
+ * those.  The clock is picked by the first timestamped chunk, and
+ * chunks without a timestamp from that clock are ignored.
+ */
+struct strokkur_recv_stats {
+        uint64_t first_arrival_us;
+        uint64_t last_arrival_us;
+        uint64_t last_gap_us;
+        uint64_t max_gap_us;
+        /*
+         * Smoothed difference between consecutive inter-arrival gaps.
+         * Unlike RFC 3550 jitter, this ignores when chunks were sent.
+         */
+        uint64_t gap_variation_us;
+        /*
+         * Delay between the kernel receiving the chunk that completed
+         * the message, and strokkur_recv_add_chunk (software
+         * timestamps only).
+         */
+        uint64_t completion_lag_us;
+        uint32_t arrivals;
+        /* Arrival times are in the NIC's clock. */
+        bool hardware;
+};
+
+struct strokkur_recv_state;
+
+/* Intrusive linkage in a list of receive states; unlinked if pprev is NULL. */
+struct strokkur_recv_link {
+        struct strokkur_recv_state *next;
+        struct strokkur_recv_state **pprev;
 };
 
 struct strokkur_recv_state {
         struct sockaddr_storage source;
 
+        /* Intrusive linkage for struct strokkur_wheel. */
+        struct strokkur_recv_link wheel_link;
+        uint64_t deadline_us;
+
+        /* Intrusive linkage and reservation for struct strokkur_budget. */
+        struct strokkur_recv_link budget_link;
+        size_t budget_bytes;
+        uint8_t priority;
+
         uint64_t first_received_us;
         uint64_t send_timestamp_us;
         uuid_t message_id;
         uint8_t hash[256 / 8];
         uint32_t message_bytes;
+        uint32_t generation;
+        uint32_t flags;
 
         uint16_t chunk_count;
-        uint16_t chunk_received; /* UINT16_MAX when backsolved. */
+        uint16_t chunk_stride;
+        uint16_t chunk_received; /* UINT16_MAX when decoded. */
+        struct strokkur_recv_stats stats;
         struct strokkur_chunk *chunks[STROKKUR_CHUNK_MAX];
+        /* Rows of chunks, in the order they were stored. */
+        uint16_t order[STROKKUR_CHUNK_MAX];
 };
 
 _Static_assert(STROKKUR_CHUNK_MAX < UINT16_MAX,
                "STROKKUR_CHUNK_MAX must be < UINT16_MAX.");
 
+/* Hands a chunk back to the application's chunk pool. */
+typedef void strokkur_chunk_recycle_fn(void *ctx, struct strokkur_chunk *);
+
+/**
+ * @brief Validate a chunk header received in a datagram of
+ * @a datagram_bytes (header included).
+ *
+ * @return 0 if the header is consistent, negative otherwise: -10 if the
+ * datagram is from a peer with another STROKKUR_WIRE_VERSION, -11 if
+ * the mask is empty or has bits at or past chunk_count.
+ */
+int strokkur_recv_check_header(const struct strokkur_chunk_header *header, size_t datagram_bytes);
+
 /**
  * @brief Attempt to read a strokkur chunk from socket @a fd.
  * @param fd the socket to read from
  * @param source the source of the data if successful
- * @param chunk the chunk.
+ * @param chunk the chunk.  Its receive timestamp is populated if
+ * timestamping is enabled on @a fd (see strokkur_timestamping_enable).
  *
- * @return 0 on success, negative on failure.
+ * @return 0 on success, negative on failure.  Chunks with a CRC32C
+ * that does not match (see strokkur_send_checksum) fail with -9.
  */
 int strokkur_recv_chunk(int fd, struct sockaddr_storage *source, struct strokkur_chunk *chunk);
 
 /**
  * @brief Overwrite a strokkur recv state for @a source and first
  * chunk @a chunk.
+ *
+ * @note first_received_us is read from the coarse clock (see
+ * strokkur_clock_us).  The state must not be linked in a
+ * strokkur_wheel.
  */
 void strokkur_recv_init(struct strokkur_recv_state *, const struct sockaddr_storage *source, const struct strokkur_chunk *chunk);
 
@@ -60,6 +147,15 @@ bool strokkur_recv_initialised(const struct strokkur_recv_state *);
  */
 void strokkur_recv_deinit(struct strokkur_recv_state *);
 
+/**
+ * @brief Pass every chunk in the receive state to @a recycle, and
+ * clear the state's references to them.
+ *
+ * The state's metadata is left as is, and may still be used to
+ * identify the message before calling strokkur_recv_deinit.
+ */
+void strokkur_recv_recycle(struct strokkur_recv_state *, strokkur_chunk_recycle_fn *recycle, void *ctx);
+
 /**
  * @brief Adjoin a chunk from @a source to a recv state.
  * @param source the source of the chunk as overwritten by strokkur_chunk_recv
@@ -73,8 +169,34 @@ void strokkur_recv_deinit(struct strokkur_recv_state *);
  */
 int strokkur_recv_add_chunk(struct strokkur_recv_state *, const struct sockaddr_storage *source, struct strokkur_chunk **chunk);
 
+/**
+ * @brief Adjoin a chunk view from @a source to a recv state.
+ *
+ * Views that are certainly redundant (e.g., once the message has full
+ * rank) are dropped without copying their payload.  Otherwise, the view
+ * is copied into the free chunk in @a chunk and adjoined as with
+ * strokkur_recv_add_chunk.
+ *
+ * @param chunk a pointer to a free chunk on entry; on exit, a pointer
+ * to the chunk to recycle (possibly the same unused chunk), or to NULL.
+ *
+ * @return as strokkur_recv_add_chunk, or -9 if the view's CRC32C
+ * does not match (the chunk is then unused).
+ */
+int strokkur_recv_add_view(struct strokkur_recv_state *, const struct sockaddr_storage *source, const struct strokkur_chunk_view *view, struct strokkur_chunk **chunk);
+
 bool strokkur_recv_ready(const struct strokkur_recv_state *);
 
+/**
+ * @brief Estimate the network one-way delay of a message: the first
+ * chunk's kernel receive timestamp minus the send timestamp.
+ *
+ * @note the estimate includes the offset between the sender and the
+ * receiver's clocks, and is 0 unless the arrival statistics are in
+ * the kernel's clock (not the NIC's).
+ */
+int64_t strokkur_recv_one_way_delay_us(const struct strokkur_recv_state *);
+
 /**
  * @brief Flatten a message and write up to @a bufsz bytes of it in @a buf.
  * @return negative on failure, the size of the strokkur message on failure
@@ -0,0 +1,403 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+/* Linux 4.4 and later. */
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+#endif
+
+#include "strokkur_ring.h"
+
+#ifdef TPACKET3_HDRLEN
+/* Only wake up for UDP datagrams to our port. */
+static int
+attach_filter(int fd, uint16_t port)
+{
+        struct sock_filter code[] = {
+                /* 0: Dispatch on the ethertype. */
+                BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 7),
+                /* 2: IPv4: UDP, first fragment without more fragments. */
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 11),
+                BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+                BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 9, 0),
+                BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+                BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 5, 6),
+                /* 9: IPv6: UDP without extension headers. */
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 0, 5),
+                BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 6),
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 3),
+                BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 42),
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+                /* 14: Accept. */
+                BPF_STMT(BPF_RET | BPF_K, UINT32_MAX),
+                /* 15: Drop. */
+                BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+        struct sock_fprog program = {
+                .len = sizeof(code) / sizeof(code[0]),
+                .filter = code,
+        };
+
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                       &program, sizeof(program)) != 0) {
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+strokkur_ring_init(struct strokkur_ring *ring, const char *ifname,
+                   uint16_t port, size_t block_bytes, size_t block_count)
+{
+        struct tpacket_req3 req;
+        struct sockaddr_ll addr;
+        int version = TPACKET_V3;
+        void *map;
+        int ret = -1;
+
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = if_nametoindex(ifname);
+        if (addr.sll_ifindex == 0) {
+                return -1;
+        }
+
+        /*
+         * Cooked packets start at the network header.  With protocol
+         * 0, the socket receives nothing until it is bound to our
+         * interface, so the ring never sees other interfaces' frames.
+         */
+        ring->fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+        if (ring->fd < 0) {
+                return -2;
+        }
+
+        if (attach_filter(ring->fd, port) != 0) {
+                ret = -3;
+                goto fail;
+        }
+
+        if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION,
+                       &version, sizeof(version)) != 0) {
+                ret = -4;
+                goto fail;
+        }
+
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = block_bytes;
+        req.tp_block_nr = block_count;
+        /* V3 packs variable-size frames; this only sizes the ring. */
+        req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+        req.tp_frame_nr = (block_bytes / req.tp_frame_size) * block_count;
+        /* Hand partially filled blocks to userspace after 1 ms. */
+        req.tp_retire_blk_tov = 1;
+        if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING,
+                       &req, sizeof(req)) != 0) {
+                ret = -5;
+                goto fail;
+        }
+
+        map = mmap(NULL, block_bytes * block_count, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, ring->fd, 0);
+        if (map == MAP_FAILED) {
+                ret = -6;
+                goto fail;
+        }
+
+        ring->map = map;
+        ring->port = htons(port);
+        ring->block_bytes = block_bytes;
+        ring->block_count = block_count;
+
+        /* Start receiving, only from ifindex. */
+        if (bind(ring->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                ret = -7;
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        strokkur_ring_deinit(ring);
+        return ret;
+}
+
+void
+strokkur_ring_deinit(struct strokkur_ring *ring)
+{
+
+        if (ring->map != NULL) {
+                munmap(ring->map, ring->block_bytes * ring->block_count);
+        }
+
+        if (ring->fd >= 0) {
+                close(ring->fd);
+        }
+
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+        return;
+}
+
+static struct tpacket_block_desc *
+block_desc(const struct strokkur_ring *ring, size_t block)
+{
+
+        return (struct tpacket_block_desc *)(ring->map + block * ring->block_bytes);
+}
+
+/* Add @a n bytes to a ones' complement sum, as 16-bit big-endian words. */
+static uint32_t
+checksum_add(uint32_t sum, const uint8_t *bytes, size_t n)
+{
+
+        for (size_t i = 0; i + 1 < n; i += 2) {
+                sum += (bytes[i] << 8) | bytes[i + 1];
+        }
+
+        if ((n & 1) != 0) {
+                sum += bytes[n - 1] << 8;
+        }
+
+        return sum;
+}
+
+/* @return true if the ones' complement sum @a sum folds to 0xffff. */
+static bool
+checksum_valid(uint32_t sum)
+{
+
+        while ((sum >> 16) != 0) {
+                sum = (sum & 0xffff) + (sum >> 16);
+        }
+
+        return sum == 0xffff;
+}
+
+/*
+ * Find the UDP payload in a cooked IPv4 or IPv6 packet for our port.
+ * If @a verify, also check the IPv4 header and UDP checksums, which
+ * the kernel has not.
+ * @return the payload size, or 0 if the packet is not for us.
+ */
+static size_t
+parse_udp(const struct strokkur_ring *ring, uint16_t protocol,
+          const uint8_t *packet, size_t n, bool verify,
+          struct sockaddr_storage *source, const uint8_t **payload)
+{
+        size_t ip_bytes;
+        const uint8_t *udp;
+        uint16_t udp_bytes;
+        uint32_t sum;
+
+        memset(source, 0, sizeof(*source));
+        if (protocol == htons(ETH_P_IP)) {
+                struct sockaddr_in *in = (struct sockaddr_in *)source;
+
+                if (n < 20 || (packet[0] >> 4) != 4 || packet[9] != IPPROTO_UDP) {
+                        return 0;
+                }
+
+                /* Fragments (offset or more fragments) are not for us. */
+                if ((((packet[6] << 8) | packet[7]) & 0x3fff) != 0) {
+                        return 0;
+                }
+
+                ip_bytes = 4 * (packet[0] & 0xf);
+                if (verify && (ip_bytes < 20 || n < ip_bytes ||
+                               !checksum_valid(checksum_add(0, packet, ip_bytes)))) {
+                        return 0;
+                }
+
+                /* Pseudo-header: addresses, protocol and UDP length. */
+                sum = checksum_add(IPPROTO_UDP, packet + 12, 8);
+                in->sin_family = AF_INET;
+                memcpy(&in->sin_addr, packet + 12, sizeof(in->sin_addr));
+        } else if (protocol == htons(ETH_P_IPV6)) {
+                struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)source;
+
+                if (n < 40 || (packet[0] >> 4) != 6 || packet[6] != IPPROTO_UDP) {
+                        return 0;
+                }
+
+                ip_bytes = 40;
+                sum = checksum_add(IPPROTO_UDP, packet + 8, 32);
+                in6->sin6_family = AF_INET6;
+                memcpy(&in6->sin6_addr, packet + 8, sizeof(in6->sin6_addr));
+        } else {
+                return 0;
+        }
+
+        if (ip_bytes < 20 || n < ip_bytes + 8) {
+                return 0;
+        }
+
+        udp = packet + ip_bytes;
+        if (memcmp(udp + 2, &ring->port, sizeof(ring->port)) != 0) {
+                return 0;
+        }
+
+        udp_bytes = (udp[4] << 8) | udp[5];
+        if (udp_bytes < 8 || udp_bytes > n - ip_bytes) {
+                return 0;
+        }
+
+        /* A zero UDP checksum means none, which only IPv4 allows. */
+        if (verify && (udp[6] != 0 || udp[7] != 0 || protocol != htons(ETH_P_IP))) {
+                sum += udp_bytes;
+                if (!checksum_valid(checksum_add(sum, udp, udp_bytes))) {
+                        return 0;
+                }
+        }
+
+        /* The source port is at the same offset in both families. */
+        memcpy(&((struct sockaddr_in *)source)->sin_port, udp, sizeof(uint16_t));
+        *payload = udp + 8;
+        return udp_bytes - 8;
+}
+
+static int
+parse_frame(const struct strokkur_ring *ring, const struct tpacket3_hdr *frame,
+            struct sockaddr_storage *source, struct strokkur_chunk_view *view)
+{
+        const struct sockaddr_ll *addr;
+        const uint8_t *payload;
+        size_t payload_bytes;
+        bool verify;
+
+        addr = (const struct sockaddr_ll *)((const uint8_t *)frame + TPACKET_ALIGN(sizeof(*frame)));
+        if (addr->sll_pkttype == PACKET_OUTGOING) {
+                return -1;
+        }
+
+        /* Truncated copy. */
+        if (frame->tp_snaplen != frame->tp_len) {
+                return -1;
+        }
+
+        /*
+         * The kernel verifies checksums for UDP sockets, not for packet
+         * sockets: trust only the NIC's verdict, or packets sent from
+         * this host (whose checksum is not computed yet).
+         */
+        verify = (frame->tp_status & (TP_STATUS_CSUM_VALID | TP_STATUS_CSUMNOTREADY)) == 0;
+        payload_bytes = parse_udp(ring, addr->sll_protocol,
+                                  (const uint8_t *)frame + frame->tp_mac,
+                                  frame->tp_snaplen, verify, source, &payload);
+        if (payload_bytes < sizeof(view->header)) {
+                return -1;
+        }
+
+        memcpy(&view->header, payload, sizeof(view->header));
+        if (strokkur_recv_check_header(&view->header, payload_bytes) != 0) {
+                return -1;
+        }
+
+        view->data = payload + sizeof(view->header);
+        view->received_us = (uint64_t)frame->tp_sec * 1000000UL + frame->tp_nsec / 1000;
+        view->received_hw_us = 0;
+        if ((frame->tp_status & TP_STATUS_TS_RAW_HARDWARE) != 0) {
+                view->received_hw_us = view->received_us;
+                view->received_us = 0;
+        }
+
+        return 0;
+}
+
+int
+strokkur_ring_next(struct strokkur_ring *ring,
+                   struct sockaddr_storage *source,
+                   struct strokkur_chunk_view *view)
+{
+
+        for (;;) {
+                const struct tpacket3_hdr *frame;
+
+                if (ring->frames_left == 0) {
+                        struct tpacket_block_desc *desc = block_desc(ring, ring->block);
+
+                        if (ring->frame != NULL) {
+                                /* Done with every view in this block. */
+                                __atomic_store_n(&desc->hdr.bh1.block_status,
+                                                 TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                                ring->block = (ring->block + 1) % ring->block_count;
+                                ring->frame = NULL;
+                                desc = block_desc(ring, ring->block);
+                        }
+
+                        if ((__atomic_load_n(&desc->hdr.bh1.block_status,
+                                             __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                                return -1;
+                        }
+
+                        ring->frames_left = desc->hdr.bh1.num_pkts;
+                        ring->frame = (const uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt;
+                        continue;
+                }
+
+                frame = (const struct tpacket3_hdr *)ring->frame;
+                ring->frames_left--;
+                ring->frame += frame->tp_next_offset;
+                if (parse_frame(ring, frame, source, view) == 0) {
+                        return 0;
+                }
+        }
+}
+#else
+int
+strokkur_ring_init(struct strokkur_ring *ring, const char *ifname,
+                   uint16_t port, size_t block_bytes, size_t block_count)
+{
+
+        (void)ifname;
+        (void)port;
+        (void)block_bytes;
+        (void)block_count;
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+        return -1;
+}
+
+void
+strokkur_ring_deinit(struct strokkur_ring *ring)
+{
+
+        memset(ring, 0, sizeof(*ring));
+        ring->fd = -1;
+        return;
+}
+
+int
+strokkur_ring_next(struct strokkur_ring *ring,
+                   struct sockaddr_storage *source,
+                   struct strokkur_chunk_view *view)
+{
+
+        (void)ring;
+        (void)source;
+        (void)view;
+        return -1;
+}
+#endif
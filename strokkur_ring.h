@@ -0,0 +1,69 @@
+#ifndef STROKKUR_RING_H
+#define STROKKUR_RING_H
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "strokkur_recv.h"
+
+/*
+ * An AF_PACKET TPACKET_V3 receive ring for the strokkur datagrams sent
+ * to one UDP port on one interface.  Chunks are parsed in place, and
+ * handed out as struct strokkur_chunk_view.
+ *
+ * Only unfragmented IPv4 datagrams and IPv6 datagrams without
+ * extension headers are recognised, so chunks must fit in the
+ * interface's MTU (loopback's is 64KB).  The kernel still delivers a
+ * copy of each datagram to any UDP socket bound to the port.
+ *
+ * Packet sockets see datagrams before the kernel checks their
+ * checksums.  Frames whose checksum the NIC validated
+ * (TP_STATUS_CSUM_VALID), or which were sent from this host and are
+ * not checksummed yet (TP_STATUS_CSUMNOTREADY), are taken as is; for
+ * any other frame, the ring verifies the IPv4 header and UDP checksums
+ * itself, and drops the frame if either is wrong.
+ */
+struct strokkur_ring {
+        int fd;
+        uint16_t port; /* Network byte order. */
+        uint8_t *map;
+        size_t block_bytes;
+        size_t block_count;
+        size_t block;
+        /* Frames left in the current block; frame is NULL between blocks. */
+        uint32_t frames_left;
+        const uint8_t *frame;
+};
+
+/**
+ * @brief Map a receive ring of @a block_count blocks of @a block_bytes
+ * for strokkur datagrams sent to UDP @a port (host byte order) on
+ * interface @a ifname.
+ *
+ * @a block_bytes must be a multiple of the page size, and larger than
+ * any datagram.  Requires CAP_NET_RAW.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_ring_init(struct strokkur_ring *, const char *ifname, uint16_t port,
+                       size_t block_bytes, size_t block_count);
+
+/**
+ * @brief Unmap the ring and close its socket.
+ */
+void strokkur_ring_deinit(struct strokkur_ring *);
+
+/**
+ * @brief Parse the next strokkur chunk in the ring.
+ *
+ * On success, @a source is overwritten with the source of the chunk,
+ * as strokkur_recv_chunk would, and @a view points into the ring.  The
+ * view is only valid until the next call to strokkur_ring_next: pass it
+ * to strokkur_recv_add_view, or copy it out, before then.
+ *
+ * @return 0 on success, negative when the ring is empty (wait for the
+ * ring's fd to be readable).
+ */
+int strokkur_ring_next(struct strokkur_ring *, struct sockaddr_storage *source,
+                       struct strokkur_chunk_view *view);
+#endif /* !STROKKUR_RING_H */
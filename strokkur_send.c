@@ -1,11 +1,18 @@
+#define _GNU_SOURCE /* sendmmsg */
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/uio.h>
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
 /* Use arc4random for now. */
 #ifdef __linux__
 #include <bsd/stdlib.h>
@@ -61,10 +68,30 @@ strokkur_send_init(struct strokkur_send_state *state,
                    const void *data, size_t n_bytes,
                    size_t redundant_messages)
 {
+
+        return strokkur_send_init_sized(state, fd, dst, data, n_bytes,
+                                        redundant_messages,
+                                        STROKKUR_CHUNK_DATA_MAX);
+}
+
+int
+strokkur_send_init_sized(struct strokkur_send_state *state,
+                         int fd, const struct sockaddr_storage *dst,
+                         const void *data, size_t n_bytes,
+                         size_t redundant_messages, size_t chunk_bytes)
+{
         size_t n_chunk;
 
         memset(state, 0, (char *)(&state->scratch) - (char *)state);
-        if (n_bytes > STROKKUR_CHUNK_MAX * STROKKUR_CHUNK_DATA_MAX) {
+        if (chunk_bytes > STROKKUR_CHUNK_DATA_MAX) {
+                chunk_bytes = STROKKUR_CHUNK_DATA_MAX;
+        }
+
+        if (chunk_bytes == 0) {
+                return -3;
+        }
+
+        if (n_bytes > STROKKUR_CHUNK_MAX * chunk_bytes) {
                 return -1;
         }
 
@@ -72,7 +99,7 @@ strokkur_send_init(struct strokkur_send_state *state,
                 return -2;
         }
 
-        n_chunk = (n_bytes + STROKKUR_CHUNK_DATA_MAX - 1) / STROKKUR_CHUNK_DATA_MAX;
+        n_chunk = (n_bytes + chunk_bytes - 1) / chunk_bytes;
 
         if (redundant_messages > STROKKUR_MAX_REDUNDANT) {
                 redundant_messages = STROKKUR_MAX_REDUNDANT;
@@ -104,10 +131,79 @@ strokkur_send_init(struct strokkur_send_state *state,
         (void)state->header.hash;
         state->header.message_bytes = n_bytes;
         state->header.chunk_count = n_chunk;
+        state->header.chunk_stride = chunk_bytes;
+        state->header.version = STROKKUR_WIRE_VERSION;
         init_extra_row_mask(state, n_chunk, redundant_messages);
         return 0;
 }
 
+size_t
+strokkur_chunk_bytes_for_mtu(size_t mtu, int family)
+{
+        size_t overhead = 8 + sizeof(struct strokkur_chunk_header);
+        size_t chunk_bytes;
+
+        overhead += (family == AF_INET6) ? 40 : 20;
+        if (mtu < overhead + 64) {
+                return 0;
+        }
+
+        chunk_bytes = (mtu - overhead) & ~63UL;
+        if (chunk_bytes > STROKKUR_CHUNK_DATA_MAX) {
+                chunk_bytes = STROKKUR_CHUNK_DATA_MAX;
+        }
+
+        return chunk_bytes;
+}
+
+size_t
+strokkur_path_chunk_bytes(int fd)
+{
+        struct sockaddr_storage self;
+        socklen_t self_len = sizeof(self);
+        int mtu = 0;
+        socklen_t mtu_len = sizeof(mtu);
+
+        if (getsockname(fd, (struct sockaddr *)&self, &self_len) != 0) {
+                return 0;
+        }
+
+        switch (self.ss_family) {
+#ifdef IP_MTU
+        case AF_INET:
+                if (getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &mtu_len) != 0) {
+                        return 0;
+                }
+
+                break;
+#endif
+#ifdef IPV6_MTU
+        case AF_INET6:
+                if (getsockopt(fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &mtu_len) != 0) {
+                        return 0;
+                }
+
+                break;
+#endif
+        default:
+                return 0;
+        }
+
+        if (mtu <= 0) {
+                return 0;
+        }
+
+        return strokkur_chunk_bytes_for_mtu(mtu, self.ss_family);
+}
+
+void
+strokkur_send_checksum(struct strokkur_send_state *state)
+{
+
+        state->header.flags |= STROKKUR_CHUNK_CRC32C;
+        return;
+}
+
 bool
 strokkur_send_initialised(const struct strokkur_send_state *state)
 {
@@ -123,10 +219,29 @@ strokkur_send_deinit(struct strokkur_send_state *state)
         return;
 }
 
+/* Index of the last chunk in the row, for the fused checksum. */
+static size_t
+last_column(const struct strokkur_send_state *state)
+{
+
+        for (size_t word = (state->n_base + 31) / 32; word --> 0;) {
+                uint32_t bits = state->header.mask[word];
+
+                if (bits != 0) {
+                        return 32 * word + 31 - __builtin_clz(bits);
+                }
+        }
+
+        return SIZE_MAX;
+}
+
 static int
 xor_columns(struct strokkur_send_state *state)
 {
         size_t chunk_count = state->n_base;
+        size_t stride = state->header.chunk_stride;
+        bool checksum = (state->header.flags & STROKKUR_CHUNK_CRC32C) != 0;
+        size_t last = checksum ? last_column(state) : SIZE_MAX;
         bool initialised = false;
 
         for (size_t i = 0; i < chunk_count; i++) {
@@ -138,20 +253,34 @@ xor_columns(struct strokkur_send_state *state)
                         continue;
                 }
 
-                offset = i * STROKKUR_CHUNK_DATA_MAX;
+                offset = i * stride;
                 bytes = state->n_bytes - offset;
-                if (bytes > STROKKUR_CHUNK_DATA_MAX) {
-                        bytes = STROKKUR_CHUNK_DATA_MAX;
+                if (bytes > stride) {
+                        bytes = stride;
                 }
 
                 buf = (const char *)state->data + offset;
-                if (initialised == false) {
+                if (i == last) {
+                        /* Checksum the row in its last pass. */
+                        uint32_t crc;
+
+                        if (initialised == false) {
+                                crc = strokkur_block_copy_crc32c(state->scratch, buf, bytes, 0);
+                                memset(state->scratch + bytes, 0, stride - bytes);
+                        } else {
+                                crc = strokkur_block_xor_crc32c(state->scratch, buf, bytes, 0);
+                        }
+
+                        initialised = true;
+                        state->scratch_crc = strokkur_crc32c(crc, state->scratch + bytes,
+                                                             stride - bytes);
+                } else if (initialised == false) {
                         initialised = true;
                         memcpy(state->scratch, buf, bytes);
 
-                        if (bytes < STROKKUR_CHUNK_DATA_MAX) {
+                        if (bytes < stride) {
                                 memset(state->scratch + bytes, 0,
-                                       STROKKUR_CHUNK_DATA_MAX - bytes);
+                                       stride - bytes);
                         }
                 } else {
                         strokkur_block_xor(state->scratch, buf, bytes);
@@ -165,9 +294,29 @@ xor_columns(struct strokkur_send_state *state)
         return 0;
 }
 
+/* Claim the ids the kernel gives the next @a n datagrams sent for @a state. */
+static void
+claim_tx_ids(struct strokkur_send_state *state, uint32_t n)
+{
+        struct strokkur_tx_ids *tx_ids = state->tx_ids;
+
+        if (tx_ids == NULL || n == 0) {
+                return;
+        }
+
+        if (state->tx_sent == 0) {
+                state->tx_first_id = tx_ids->next_id;
+        }
+
+        tx_ids->next_id += n;
+        state->tx_sent += n;
+        return;
+}
+
 static int
 send_chunk(int fd, const struct sockaddr_storage *dst,
-           const struct strokkur_chunk_header *header, const void *data)
+           const struct strokkur_chunk_header *header, const void *data,
+           int flags)
 {
         struct iovec iov[2];
         struct msghdr message;
@@ -186,7 +335,7 @@ send_chunk(int fd, const struct sockaddr_storage *dst,
         message.msg_iov = iov;
         message.msg_iovlen = 2;
 
-        ret = sendmsg(fd, &message, 0);
+        ret = sendmsg(fd, &message, flags);
         if (ret < 0) {
                 return -1;
         }
@@ -198,10 +347,212 @@ send_chunk(int fd, const struct sockaddr_storage *dst,
         return 0;
 }
 
+/*
+ * Send as much of a batch as the socket accepts, and advance the
+ * cursor of every destination that got the chunk.
+ */
+static int
+flush_fanout_batch(struct strokkur_fanout *fanout, struct mmsghdr *messages,
+                   struct strokkur_fanout_dest **batch, size_t n)
+{
+        size_t done = 0;
+
+        while (done < n) {
+                int r;
+
+                r = sendmmsg(fanout->encoder.fd, messages + done, n - done, 0);
+                if (r < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                            errno == ENOBUFS || errno == EINTR) {
+                                return -1;
+                        }
+
+                        /* Hard error for this destination: drop the datagram. */
+                        fanout->errors++;
+                        batch[done]->progress++;
+                        done++;
+                        continue;
+                }
+
+                for (int i = 0; i < r; i++) {
+                        batch[done + i]->progress++;
+                }
+
+                claim_tx_ids(&fanout->encoder, r);
+
+                done += r;
+        }
+
+        return 0;
+}
+
+static int
+send_fanout_chunk(struct strokkur_fanout *fanout,
+                  const struct strokkur_chunk_header *header, const void *data)
+{
+        struct mmsghdr messages[STROKKUR_FANOUT_BATCH];
+        struct strokkur_fanout_dest *batch[STROKKUR_FANOUT_BATCH];
+        struct iovec iov[2];
+        size_t n = 0;
+
+        memset(&iov, 0, sizeof(iov));
+        iov[0].iov_base = (void *)header;
+        iov[0].iov_len = sizeof(*header);
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = header->chunk_bytes;
+
+        for (size_t i = 0; i <= fanout->n_dests; i++) {
+                if (i < fanout->n_dests) {
+                        struct strokkur_fanout_dest *dest = &fanout->dests[i];
+                        struct msghdr *message = &messages[n].msg_hdr;
+
+                        if (dest->progress != fanout->sent) {
+                                continue;
+                        }
+
+                        memset(&messages[n], 0, sizeof(messages[n]));
+                        message->msg_name = &dest->dst;
+                        message->msg_namelen = sizeof(dest->dst);
+                        message->msg_iov = iov;
+                        message->msg_iovlen = 2;
+                        batch[n++] = dest;
+                        if (n < STROKKUR_FANOUT_BATCH) {
+                                continue;
+                        }
+                }
+
+                if (n > 0) {
+                        int r;
+
+                        r = flush_fanout_batch(fanout, messages, batch, n);
+                        if (r != 0) {
+                                return r;
+                        }
+
+                        n = 0;
+                }
+        }
+
+        fanout->sent++;
+        return 0;
+}
+
+static bool
+zerocopy_completed(const struct strokkur_zerocopy *zerocopy, uint32_t id)
+{
+
+        return (int32_t)(id - zerocopy->completed) < 0;
+}
+
+#ifdef MSG_ZEROCOPY
+/*
+ * Send the current chunk for @a state with MSG_ZEROCOPY.  The kernel
+ * pins the header as well as @a data, so zero-copy sends use one of the
+ * state's stable header copies.
+ *
+ * @return 0 on success, negative on failure, 1 if the chunk should be
+ * copied instead.
+ */
+static int
+send_zerocopy_chunk(struct strokkur_send_state *state, const void *data)
+{
+        struct strokkur_zerocopy *zerocopy = state->zerocopy;
+        size_t slot = state->zerocopy_sent % STROKKUR_ZEROCOPY_HEADERS;
+        struct strokkur_chunk_header *header = &state->zerocopy_header[slot];
+        int r;
+
+        if (zerocopy->copied ||
+            state->header.chunk_bytes < STROKKUR_ZEROCOPY_MIN_BYTES) {
+                return 1;
+        }
+
+        if (state->zerocopy_sent >= STROKKUR_ZEROCOPY_HEADERS &&
+            !zerocopy_completed(zerocopy, state->zerocopy_header_id[slot])) {
+                return 1;
+        }
+
+        /* Keep every completion within the tracker's bitmap. */
+        if (zerocopy->next_id - zerocopy->completed >= STROKKUR_ZEROCOPY_WINDOW) {
+                return 1;
+        }
+
+        memcpy(header, &state->header, sizeof(*header));
+        r = send_chunk(state->fd, &state->dst, header, data, MSG_ZEROCOPY);
+        if (r == -1) {
+                /* ENOBUFS: too much memory pinned on the socket. */
+                return (errno == ENOBUFS) ? 1 : r;
+        }
+
+        /* Any successful sendmsg consumes an id. */
+        state->zerocopy_header_id[slot] = zerocopy->next_id;
+        state->zerocopy_last = zerocopy->next_id++;
+        state->zerocopy_sent++;
+        if (data == state->scratch) {
+                state->scratch_id = state->zerocopy_last;
+                state->scratch_pinned = true;
+        }
+
+        return r;
+}
+#endif
+
+static int
+send_state_chunk(struct strokkur_send_state *state, const void *data)
+{
+        int r;
+
+        if ((state->header.flags & STROKKUR_CHUNK_CRC32C) != 0) {
+                uint32_t crc = state->scratch_crc;
+
+                /* Rows in scratch were checksummed by xor_columns. */
+                if (data != state->scratch) {
+                        crc = strokkur_crc32c(0, data, state->header.chunk_bytes);
+                }
+
+                state->header.crc32c = strokkur_chunk_crc32c(&state->header, crc);
+        }
+
+        if (state->fanout != NULL) {
+                return send_fanout_chunk(state->fanout, &state->header, data);
+        }
+
+#ifdef MSG_ZEROCOPY
+        if (state->zerocopy != NULL) {
+                r = send_zerocopy_chunk(state, data);
+                if (r <= 0) {
+                        goto out;
+                }
+        }
+#endif
+
+        r = send_chunk(state->fd, &state->dst, &state->header, data, 0);
+#ifdef MSG_ZEROCOPY
+out:
+#endif
+        if (r == 0) {
+                claim_tx_ids(state, 1);
+        }
+
+        return r;
+}
+
+/* Can we overwrite the scratch row? */
+static bool
+scratch_released(const struct strokkur_send_state *state)
+{
+
+        if (state->scratch_pinned == false) {
+                return true;
+        }
+
+        return zerocopy_completed(state->zerocopy, state->scratch_id);
+}
+
 static int
 pump_base(struct strokkur_send_state *state)
 {
-        size_t offset = state->progress * STROKKUR_CHUNK_DATA_MAX;
+        size_t stride = state->header.chunk_stride;
+        size_t offset = state->progress * stride;
         size_t size = state->n_bytes - offset;
         size_t word = state->progress / 32;
         size_t shift = state->progress % 32;
@@ -209,14 +560,13 @@ pump_base(struct strokkur_send_state *state)
 
         assert(state->progress < STROKKUR_CHUNK_MAX);
         assert(offset < state->n_bytes);
-        if (size > STROKKUR_CHUNK_DATA_MAX) {
-                size = STROKKUR_CHUNK_DATA_MAX;
+        if (size > stride) {
+                size = stride;
         }
 
         state->header.chunk_bytes = size;
         state->header.mask[word] = 1UL << shift;
-        r = send_chunk(state->fd, &state->dst,
-                       &state->header, (const char *)state->data + offset);
+        r = send_state_chunk(state, (const char *)state->data + offset);
         state->header.mask[word] = 0;
 
         if (r == 0) {
@@ -232,8 +582,7 @@ pump_singleton(struct strokkur_send_state *state)
         int r;
 
         state->header.mask[0] = 1UL;
-        r = send_chunk(state->fd, &state->dst,
-                       &state->header, state->data);
+        r = send_state_chunk(state, state->data);
 
         if (r == 0) {
                 state->progress += 2;
@@ -250,15 +599,16 @@ pump_full_row(struct strokkur_send_state *state)
 
         if (state->progress == chunk_count) {
                 for (size_t i = 0; i < chunk_count; i++) {
-                        state->header.mask[i / 32] = 1UL << (i % 32);
+                        state->header.mask[i / 32] |= 1UL << (i % 32);
                 }
 
                 xor_columns(state);
+                /* Summaries are zero-padded to a full stride. */
+                state->header.chunk_bytes = state->header.chunk_stride;
                 state->progress++;
         }
 
-        r = send_chunk(state->fd, &state->dst,
-                       &state->header, state->scratch);
+        r = send_state_chunk(state, state->scratch);
 
         if (r == 0) {
                 state->progress++;
@@ -276,8 +626,13 @@ pump_random_row(struct strokkur_send_state *state)
         if ((state->progress % 2) == 0) {
                 size_t row = (state->progress - chunk_count - 2) / 2;
 
+                if (!scratch_released(state)) {
+                        return 2;
+                }
+
                 memcpy(state->header.mask, state->masks[row],
                        sizeof(state->header.mask));
+                state->header.chunk_bytes = state->header.chunk_stride;
                 r = xor_columns(state);
 
                 if (r != 0) {
@@ -289,8 +644,7 @@ pump_random_row(struct strokkur_send_state *state)
                 state->progress++;
         }
 
-        r = send_chunk(state->fd, &state->dst,
-                       &state->header, state->scratch);
+        r = send_state_chunk(state, state->scratch);
         if (r == 0) {
                 state->progress++;
         }
@@ -298,6 +652,251 @@ pump_random_row(struct strokkur_send_state *state)
         return r;
 }
 
+int
+strokkur_send_read_event(int fd, struct strokkur_send_event *event)
+{
+#ifdef MSG_ERRQUEUE
+        /* With SOF_TIMESTAMPING_OPT_TSONLY, notifications have no payload. */
+        uint8_t packet[64];
+        struct iovec iov[1];
+        struct msghdr message;
+        bool timestamping = false;
+        union {
+                struct cmsghdr align;
+                char buf[512];
+        } control;
+        ssize_t ret;
+
+        memset(event, 0, sizeof(*event));
+        memset(&message, 0, sizeof(message));
+        memset(&iov, 0, sizeof(iov));
+
+        iov[0].iov_base = packet;
+        iov[0].iov_len = sizeof(packet);
+
+        message.msg_iov = iov;
+        message.msg_iovlen = 1;
+        message.msg_control = &control;
+        message.msg_controllen = sizeof(control);
+
+        ret = recvmsg(fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (ret < 0) {
+                return -1;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&message, cmsg)) {
+                struct sock_extended_err err;
+
+                if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                        continue;
+                }
+
+                if (cmsg->cmsg_len < CMSG_LEN(sizeof(err))) {
+                        continue;
+                }
+
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+                if (err.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                        event->type = STROKKUR_SEND_EVENT_ZEROCOPY;
+                        event->zerocopy_lo = err.ee_info;
+                        event->zerocopy_hi = err.ee_data;
+                        event->zerocopy_copied =
+                                (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+                        return 0;
+                }
+#endif
+                if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                        /* The SOF_TIMESTAMPING_OPT_ID of the datagram. */
+                        event->tx_id = err.ee_data;
+                        timestamping = true;
+                }
+        }
+
+        if (!timestamping ||
+            strokkur_timestamp_cmsg(&message, &event->tx_us, &event->tx_hw_us) != 0) {
+                return 0;
+        }
+
+        event->type = STROKKUR_SEND_EVENT_TX_TIMESTAMP;
+        return 0;
+#else
+        (void)fd;
+        memset(event, 0, sizeof(*event));
+        return -1;
+#endif
+}
+
+static void
+note_tx(uint64_t *first_us, uint64_t *last_us, uint64_t tx_us)
+{
+
+        if (tx_us == 0) {
+                return;
+        }
+
+        if (*first_us == 0 || tx_us < *first_us) {
+                *first_us = tx_us;
+        }
+
+        if (tx_us > *last_us) {
+                *last_us = tx_us;
+        }
+
+        return;
+}
+
+int
+strokkur_send_note_event(struct strokkur_send_state *state,
+                         const struct strokkur_send_event *event)
+{
+
+        if (event->type != STROKKUR_SEND_EVENT_TX_TIMESTAMP) {
+                return 0;
+        }
+
+        if (state->tx_sent == 0 || event->tx_id - state->tx_first_id >= state->tx_sent) {
+                return -1;
+        }
+
+        /* Software and hardware stamps arrive as separate notifications. */
+        note_tx(&state->first_tx_us, &state->last_tx_us, event->tx_us);
+        note_tx(&state->first_tx_hw_us, &state->last_tx_hw_us, event->tx_hw_us);
+        return 0;
+}
+
+void
+strokkur_tx_ids_init(struct strokkur_tx_ids *tx_ids, int fd)
+{
+
+        memset(tx_ids, 0, sizeof(*tx_ids));
+        tx_ids->fd = fd;
+        return;
+}
+
+int
+strokkur_send_tx_ids(struct strokkur_send_state *state,
+                     struct strokkur_tx_ids *tx_ids)
+{
+
+        if (tx_ids->fd != state->fd) {
+                return -1;
+        }
+
+        state->tx_ids = tx_ids;
+        return 0;
+}
+
+int
+strokkur_zerocopy_init(struct strokkur_zerocopy *zerocopy, int fd)
+{
+
+        memset(zerocopy, 0, sizeof(*zerocopy));
+        zerocopy->fd = fd;
+#ifdef SO_ZEROCOPY
+        {
+                int one = 1;
+
+                if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY,
+                               &one, sizeof(one)) != 0) {
+                        return -1;
+                }
+        }
+
+        return 0;
+#else
+        return -1;
+#endif
+}
+
+int
+strokkur_send_zerocopy(struct strokkur_send_state *state,
+                       struct strokkur_zerocopy *zerocopy)
+{
+
+        if (zerocopy->fd != state->fd) {
+                return -1;
+        }
+
+        state->zerocopy = zerocopy;
+        return 0;
+}
+
+bool
+strokkur_send_released(const struct strokkur_send_state *state)
+{
+
+        if (state->zerocopy == NULL || state->zerocopy_sent == 0) {
+                return true;
+        }
+
+        return zerocopy_completed(state->zerocopy, state->zerocopy_last);
+}
+
+static uint64_t *
+done_word(struct strokkur_zerocopy *zerocopy, uint32_t id, uint64_t *bit)
+{
+
+        id %= STROKKUR_ZEROCOPY_WINDOW;
+        *bit = 1ULL << (id % 64);
+        return &zerocopy->done[id / 64];
+}
+
+int
+strokkur_zerocopy_note_event(struct strokkur_zerocopy *zerocopy,
+                             const struct strokkur_send_event *event)
+{
+        uint32_t lo, hi;
+        uint64_t bit, *word;
+
+        if (event->type != STROKKUR_SEND_EVENT_ZEROCOPY) {
+                return 0;
+        }
+
+        if (event->zerocopy_copied) {
+                zerocopy->copied = true;
+        }
+
+        /* Only ids in flight, [completed, next_id), are in the bitmap. */
+        lo = event->zerocopy_lo;
+        hi = event->zerocopy_hi;
+        if (zerocopy_completed(zerocopy, lo)) {
+                lo = zerocopy->completed;
+        }
+
+        if ((int32_t)(hi - zerocopy->next_id) >= 0) {
+                hi = zerocopy->next_id - 1;
+        }
+
+        if ((int32_t)(hi - lo) < 0) {
+                return 0;
+        }
+
+        for (uint32_t id = lo;; id++) {
+                word = done_word(zerocopy, id, &bit);
+                *word |= bit;
+                if (id == hi) {
+                        break;
+                }
+        }
+
+        /* Extend the completed prefix. */
+        for (;;) {
+                word = done_word(zerocopy, zerocopy->completed, &bit);
+                if ((*word & bit) == 0) {
+                        break;
+                }
+
+                *word &= ~bit;
+                zerocopy->completed++;
+        }
+
+        return 0;
+}
+
 int
 strokkur_send_pump(struct strokkur_send_state *state)
 {
@@ -330,7 +929,7 @@ strokkur_send_pump(struct strokkur_send_state *state)
         /* Generate redundant rows. */
         assert(state->progress > chunk_count + 1);
         r = pump_random_row(state);
-        if (r > 0) {
+        if (r == 1) {
                 return strokkur_send_pump(state);
         }
 
@@ -345,3 +944,55 @@ out:
 
         return 1;
 }
+
+int
+strokkur_fanout_init(struct strokkur_fanout *fanout, int fd,
+                     struct strokkur_fanout_dest *dests, size_t n_dests,
+                     const void *data, size_t n_bytes,
+                     size_t redundant_messages)
+{
+
+        return strokkur_fanout_init_sized(fanout, fd, dests, n_dests,
+                                          data, n_bytes, redundant_messages,
+                                          STROKKUR_CHUNK_DATA_MAX);
+}
+
+int
+strokkur_fanout_init_sized(struct strokkur_fanout *fanout, int fd,
+                           struct strokkur_fanout_dest *dests, size_t n_dests,
+                           const void *data, size_t n_bytes,
+                           size_t redundant_messages, size_t chunk_bytes)
+{
+        struct sockaddr_storage nowhere;
+        int r;
+
+        memset(&nowhere, 0, sizeof(nowhere));
+        r = strokkur_send_init_sized(&fanout->encoder, fd, &nowhere,
+                                     data, n_bytes, redundant_messages,
+                                     chunk_bytes);
+        if (r != 0) {
+                return r;
+        }
+
+        if (n_dests == 0) {
+                return -3;
+        }
+
+        for (size_t i = 0; i < n_dests; i++) {
+                dests[i].progress = 0;
+        }
+
+        fanout->encoder.fanout = fanout;
+        fanout->dests = dests;
+        fanout->n_dests = n_dests;
+        fanout->sent = 0;
+        fanout->errors = 0;
+        return 0;
+}
+
+int
+strokkur_fanout_pump(struct strokkur_fanout *fanout)
+{
+
+        return strokkur_send_pump(&fanout->encoder);
+}
@@ -10,6 +10,50 @@
 /* At most 64 (+ 1) extra messages. */
 #define STROKKUR_MAX_REDUNDANT 64
 
+/* Smaller chunks are always copied: pinning pages costs more. */
+#define STROKKUR_ZEROCOPY_MIN_BYTES 4096UL
+/* Each message may have this many zero-copy chunk headers in flight. */
+#define STROKKUR_ZEROCOPY_HEADERS 16
+/* Each socket may have this many zero-copy sends in flight. */
+#define STROKKUR_ZEROCOPY_WINDOW 1024
+
+/*
+ * Tracks MSG_ZEROCOPY completions for one socket.  The kernel numbers
+ * zero-copy sends on each socket, so every zero-copy send on the socket
+ * must go through the same tracker.
+ *
+ * Chunks are copied rather than sent with MSG_ZEROCOPY once
+ * STROKKUR_ZEROCOPY_WINDOW sends are in flight, so every completion
+ * fits in the bitmap of completed ids past the completed prefix.
+ */
+struct strokkur_zerocopy {
+        int fd;
+        /* The kernel copied anyway; stop pinning pages. */
+        bool copied;
+        uint32_t next_id;
+        /* Every id before this one has completed. */
+        uint32_t completed;
+        /* Bit id % STROKKUR_ZEROCOPY_WINDOW: completed past a gap. */
+        uint64_t done[STROKKUR_ZEROCOPY_WINDOW / 64];
+};
+
+/*
+ * Numbers the datagrams sent on one socket, as the kernel does for
+ * transmit timestamps (SOF_TIMESTAMPING_OPT_ID, see
+ * strokkur_timestamping_enable), so that timestamps can be matched to
+ * send states.  Every send on the socket must go through the same
+ * tracker.
+ */
+struct strokkur_tx_ids {
+        int fd;
+        uint32_t next_id;
+};
+
+/* sendmmsg batches at most this many destinations per call. */
+#define STROKKUR_FANOUT_BATCH 64
+
+struct strokkur_fanout;
+
 struct strokkur_send_state {
         struct strokkur_chunk_header header;
         int fd;
@@ -19,8 +63,31 @@ struct strokkur_send_state {
         size_t n_base;
         size_t n_redundant;
         size_t progress;
+        /* Timestamped sends: ids [tx_first_id, tx_first_id + tx_sent). */
+        struct strokkur_tx_ids *tx_ids;
+        uint32_t tx_first_id;
+        uint32_t tx_sent;
+        /* Kernel transmit timestamps, see strokkur_send_note_event. */
+        uint64_t first_tx_us;
+        uint64_t last_tx_us;
+        /* NIC transmit timestamps, in the NIC's clock. */
+        uint64_t first_tx_hw_us;
+        uint64_t last_tx_hw_us;
+        /* Zero-copy mode, see strokkur_send_zerocopy. */
+        struct strokkur_zerocopy *zerocopy;
+        uint32_t zerocopy_sent;
+        uint32_t zerocopy_last;
+        uint32_t scratch_id;
+        bool scratch_pinned;
+        /* CRC32C of the row in scratch, see strokkur_send_checksum. */
+        uint32_t scratch_crc;
+        /* Non-NULL when the state encodes for a struct strokkur_fanout. */
+        struct strokkur_fanout *fanout;
         uint32_t masks[STROKKUR_MAX_REDUNDANT][STROKKUR_CHUNK_MAX / 32];
         uint8_t scratch[STROKKUR_CHUNK_DATA_MAX];
+        /* Stable copies of the header for in-flight zero-copy sends. */
+        uint32_t zerocopy_header_id[STROKKUR_ZEROCOPY_HEADERS];
+        struct strokkur_chunk_header zerocopy_header[STROKKUR_ZEROCOPY_HEADERS];
 };
 
 /**
@@ -38,12 +105,204 @@ int strokkur_send_init(struct strokkur_send_state *state,
                        const void *data, size_t n_bytes,
                        size_t redundant_messages);
 
+/**
+ * @brief Initialise the send state machine like strokkur_send_init,
+ * but with at most @a chunk_bytes (and at most STROKKUR_CHUNK_DATA_MAX)
+ * of data per datagram.  The message may then have at most
+ * STROKKUR_CHUNK_MAX * @a chunk_bytes bytes.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_send_init_sized(struct strokkur_send_state *state,
+                             int fd, const struct sockaddr_storage *dst,
+                             const void *data, size_t n_bytes,
+                             size_t redundant_messages, size_t chunk_bytes);
+
+/**
+ * @brief Return the largest chunk size (a multiple of 64 bytes) for
+ * which a strokkur datagram to an @a family (AF_INET or AF_INET6)
+ * address fits in @a mtu bytes, without IP fragmentation.
+ *
+ * @return the chunk size, capped at STROKKUR_CHUNK_DATA_MAX, or 0 if
+ * the MTU is too small.
+ */
+size_t strokkur_chunk_bytes_for_mtu(size_t mtu, int family);
+
+/**
+ * @brief Return the chunk size for the kernel's current path MTU
+ * estimate on the connected socket @a fd.
+ *
+ * @return the chunk size as strokkur_chunk_bytes_for_mtu, or 0 if the
+ * path MTU is unknown (e.g., the socket is not connected).
+ */
+size_t strokkur_path_chunk_bytes(int fd);
+
+/**
+ * @brief Send a CRC32C of each chunk in its header, so that receivers
+ * drop corrupted datagrams before they reach the decoder.  Call right
+ * after initialisation.
+ */
+void strokkur_send_checksum(struct strokkur_send_state *state);
+
 bool strokkur_send_initialised(const struct strokkur_send_state *state);
 void strokkur_send_deinit(struct strokkur_send_state *state);
 
 /**
  * @brief send one message chunk on behalf of the @a state send machine.
- * @return negative on failure, 0 if done, 1 if more work is necessary.
+ * @return negative on failure, 0 if done, 1 if more work is necessary,
+ * 2 if the machine must wait for zero-copy completions before it can
+ * generate the next chunk.
  */
 int strokkur_send_pump(struct strokkur_send_state *state);
+
+/**
+ * @brief Prepare @a tx_ids to number the sends on socket @a fd.
+ *
+ * @note call right after strokkur_timestamping_enable, before anything
+ * is sent on @a fd: the kernel numbers datagrams from 0 from then on.
+ */
+void strokkur_tx_ids_init(struct strokkur_tx_ids *tx_ids, int fd);
+
+/**
+ * @brief Number the sends of an initialised state machine with
+ * @a tx_ids, so that strokkur_send_note_event can match its transmit
+ * timestamps.  Fan-outs pass their encoder.
+ *
+ * @return 0 on success, negative if @a tx_ids is for another socket.
+ */
+int strokkur_send_tx_ids(struct strokkur_send_state *state, struct strokkur_tx_ids *tx_ids);
+
+/**
+ * @brief Prepare @a zerocopy to track MSG_ZEROCOPY sends on socket
+ * @a fd, and enable SO_ZEROCOPY on that socket.
+ *
+ * @return 0 on success, negative on failure (e.g., zero-copy is not
+ * supported).
+ */
+int strokkur_zerocopy_init(struct strokkur_zerocopy *zerocopy, int fd);
+
+/**
+ * @brief Send the chunks of an initialised state machine with
+ * MSG_ZEROCOPY, tracked by @a zerocopy.
+ *
+ * The kernel then pins the caller's data and the state itself until
+ * the corresponding completions are noted; neither may be modified or
+ * reused before strokkur_send_released returns true.  Small chunks,
+ * and chunks sent while the kernel is short on pinned memory, are
+ * copied as usual.
+ *
+ * @return 0 on success, negative if @a zerocopy is for another socket.
+ */
+int strokkur_send_zerocopy(struct strokkur_send_state *state, struct strokkur_zerocopy *zerocopy);
+
+/**
+ * @brief Return whether the kernel has released every buffer of @a
+ * state, i.e., whether the caller's data may be reused.
+ *
+ * Always true for state machines that do not use zero-copy.
+ */
+bool strokkur_send_released(const struct strokkur_send_state *state);
+
+struct strokkur_fanout_dest {
+        struct sockaddr_storage dst;
+        size_t progress; /* Number of chunks sent to dst. */
+};
+
+/*
+ * Sends one message to many destinations.  The message is encoded
+ * once, by a single send state machine, and each chunk goes out to
+ * every destination (in sendmmsg batches) before the next one is
+ * generated.  Destinations are only an address and a cursor.
+ */
+struct strokkur_fanout {
+        struct strokkur_send_state encoder;
+        struct strokkur_fanout_dest *dests;
+        size_t n_dests;
+        size_t sent; /* Number of chunks sent to every destination. */
+        size_t errors; /* Chunks dropped on hard send errors. */
+};
+
+/**
+ * @brief Initialise a fan-out to squirt @a n_bytes in @a data to the
+ * @a n_dests destinations in @a dests via socket @a fd.
+ *
+ * A multicast group is a single destination.  @a dests must remain
+ * alive, and its addresses unchanged, until the fan-out completes.
+ *
+ * @param redundant_messages as for strokkur_send_init.
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_fanout_init(struct strokkur_fanout *fanout, int fd,
+                         struct strokkur_fanout_dest *dests, size_t n_dests,
+                         const void *data, size_t n_bytes,
+                         size_t redundant_messages);
+
+/**
+ * @brief Initialise a fan-out like strokkur_fanout_init, with at most
+ * @a chunk_bytes of data per datagram, as for strokkur_send_init_sized.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_fanout_init_sized(struct strokkur_fanout *fanout, int fd,
+                               struct strokkur_fanout_dest *dests, size_t n_dests,
+                               const void *data, size_t n_bytes,
+                               size_t redundant_messages, size_t chunk_bytes);
+
+/**
+ * @brief Send the next chunk to every destination that still needs it.
+ *
+ * A transient failure (e.g., EAGAIN) returns negative; the next call
+ * resumes with the destinations that did not get the chunk.  Hard
+ * errors for one destination count as a lost datagram, in @a errors.
+ *
+ * @return as strokkur_send_pump.
+ */
+int strokkur_fanout_pump(struct strokkur_fanout *fanout);
+
+enum strokkur_send_event_type {
+        STROKKUR_SEND_EVENT_NONE = 0,
+        STROKKUR_SEND_EVENT_TX_TIMESTAMP,
+        STROKKUR_SEND_EVENT_ZEROCOPY,
+};
+
+/* A notification from a socket's error queue. */
+struct strokkur_send_event {
+        enum strokkur_send_event_type type;
+        /* Transmit timestamps, 0 if none; see strokkur_timestamp_cmsg. */
+        uint64_t tx_us;
+        uint64_t tx_hw_us;
+        /* The id of the timestamped datagram, see struct strokkur_tx_ids. */
+        uint32_t tx_id;
+        /* Zero-copy sends [zerocopy_lo, zerocopy_hi] completed. */
+        uint32_t zerocopy_lo;
+        uint32_t zerocopy_hi;
+        bool zerocopy_copied;
+};
+
+/**
+ * @brief Read one notification from the error queue of socket @a fd,
+ * without blocking.
+ *
+ * Transmit timestamps are only queued once enabled with
+ * strokkur_timestamping_enable.  The programmer routes the event to
+ * the send state whose ids include its tx_id, see strokkur_send_tx_ids.
+ *
+ * @return 0 on success (unknown notifications have type
+ * STROKKUR_SEND_EVENT_NONE), negative on failure, e.g., if the error
+ * queue is empty.
+ */
+int strokkur_send_read_event(int fd, struct strokkur_send_event *event);
+
+/**
+ * @brief Record a notification for the message in @a state.
+ * @return 0 on success, negative if the event is for another message.
+ */
+int strokkur_send_note_event(struct strokkur_send_state *state, const struct strokkur_send_event *event);
+
+/**
+ * @brief Record zero-copy completions for the socket of @a zerocopy,
+ * in any order.  Ranges for ids that completed already are ignored.
+ * @return 0.
+ */
+int strokkur_zerocopy_note_event(struct strokkur_zerocopy *zerocopy, const struct strokkur_send_event *event);
 #endif /* !STROKKUR_SEND_H */
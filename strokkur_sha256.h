@@ -0,0 +1,23 @@
+#ifndef STROKKUR_SHA256_H
+#define STROKKUR_SHA256_H
+#include <stddef.h>
+#include <stdint.h>
+
+/* Incremental SHA-256 (FIPS 180-4). */
+struct strokkur_sha256 {
+        uint32_t state[8];
+        uint64_t n_bytes;
+        uint8_t block[64];
+};
+
+void strokkur_sha256_init(struct strokkur_sha256 *);
+void strokkur_sha256_update(struct strokkur_sha256 *, const void *data, size_t n_bytes);
+
+/**
+ * @brief Write the digest of the data so far to @a out.
+ *
+ * The context is not modified, so a running hash may be finalised
+ * at every step.
+ */
+void strokkur_sha256_final(const struct strokkur_sha256 *, uint8_t out[256 / 8]);
+#endif /* !STROKKUR_SHA256_H */
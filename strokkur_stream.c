@@ -0,0 +1,395 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "strokkur_stream.h"
+
+int
+strokkur_stream_send_init(struct strokkur_stream_send *stream,
+                          int fd, const struct sockaddr_storage *dst,
+                          const void *data, size_t n_bytes,
+                          size_t redundant_messages)
+{
+
+        memset(stream, 0, offsetof(struct strokkur_stream_send, hash));
+        if (n_bytes == 0) {
+                return -2;
+        }
+
+        stream->fd = fd;
+        memcpy(&stream->dst, dst, sizeof(stream->dst));
+        stream->redundant_messages = redundant_messages;
+        stream->chunk_bytes = STROKKUR_CHUNK_DATA_MAX;
+        strokkur_sha256_init(&stream->hash);
+        stream->data = data;
+        stream->n_bytes = n_bytes;
+        stream->offset = 0;
+        stream->src_fd = -1;
+        stream->buf = NULL;
+        stream->bufsz = 0;
+        stream->buf_fill = 0;
+        stream->eof = false;
+        return 0;
+}
+
+int
+strokkur_stream_send_init_fd(struct strokkur_stream_send *stream,
+                             int fd, const struct sockaddr_storage *dst,
+                             int src_fd, void *buf, size_t bufsz,
+                             size_t redundant_messages)
+{
+
+        memset(stream, 0, offsetof(struct strokkur_stream_send, hash));
+        if (src_fd < 0) {
+                return -1;
+        }
+
+        if (bufsz < 2) {
+                return -2;
+        }
+
+        /* One byte of lookahead past the largest generation. */
+        if (bufsz > STROKKUR_GENERATION_MAX + 1) {
+                bufsz = STROKKUR_GENERATION_MAX + 1;
+        }
+
+        stream->fd = fd;
+        memcpy(&stream->dst, dst, sizeof(stream->dst));
+        stream->redundant_messages = redundant_messages;
+        stream->chunk_bytes = STROKKUR_CHUNK_DATA_MAX;
+        strokkur_sha256_init(&stream->hash);
+        stream->data = NULL;
+        stream->n_bytes = 0;
+        stream->offset = 0;
+        stream->src_fd = src_fd;
+        stream->buf = buf;
+        stream->bufsz = bufsz;
+        stream->buf_fill = 0;
+        stream->eof = false;
+        return 0;
+}
+
+int
+strokkur_stream_send_chunk_bytes(struct strokkur_stream_send *stream,
+                                 size_t chunk_bytes)
+{
+
+        if (chunk_bytes == 0) {
+                return -1;
+        }
+
+        if (chunk_bytes > STROKKUR_CHUNK_DATA_MAX) {
+                chunk_bytes = STROKKUR_CHUNK_DATA_MAX;
+        }
+
+        stream->chunk_bytes = chunk_bytes;
+        return 0;
+}
+
+void
+strokkur_stream_send_checksum(struct strokkur_stream_send *stream)
+{
+
+        stream->checksum = true;
+        return;
+}
+
+/*
+ * Read the next generation of a file descriptor stream in the buffer.
+ * The generation is the last one iff we hit EOF before the lookahead
+ * byte.
+ */
+static int
+fill_buffer(struct strokkur_stream_send *stream)
+{
+
+        while (!stream->eof && stream->buf_fill < stream->bufsz) {
+                ssize_t r;
+
+                r = read(stream->src_fd, stream->buf + stream->buf_fill,
+                         stream->bufsz - stream->buf_fill);
+                if (r < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+
+                        return -1;
+                }
+
+                if (r == 0) {
+                        stream->eof = true;
+                        break;
+                }
+
+                stream->buf_fill += r;
+        }
+
+        return 0;
+}
+
+static int
+start_generation(struct strokkur_stream_send *stream)
+{
+        size_t generation_max = STROKKUR_CHUNK_MAX * stream->chunk_bytes;
+        const uint8_t *data;
+        size_t n_bytes;
+        bool last;
+        int r;
+
+        if (stream->src_fd >= 0) {
+                r = fill_buffer(stream);
+                if (r != 0) {
+                        return r;
+                }
+
+                data = stream->buf;
+                n_bytes = stream->buf_fill;
+                last = stream->eof;
+                if (n_bytes > stream->bufsz - 1) {
+                        n_bytes = stream->bufsz - 1;
+                        last = false;
+                }
+
+                if (n_bytes > generation_max) {
+                        n_bytes = generation_max;
+                        last = false;
+                }
+        } else {
+                data = stream->data + stream->offset;
+                n_bytes = stream->n_bytes - stream->offset;
+                last = true;
+                if (n_bytes > generation_max) {
+                        n_bytes = generation_max;
+                        last = false;
+                }
+        }
+
+        /* Fails on an empty source, as for an empty message. */
+        r = strokkur_send_init_sized(&stream->state, stream->fd, &stream->dst,
+                                     data, n_bytes, stream->redundant_messages,
+                                     stream->chunk_bytes);
+        if (r != 0) {
+                return r;
+        }
+
+        /* The first generation picks the stream's identity. */
+        if (stream->generation == 0) {
+                memcpy(stream->stream_id, stream->state.header.message_id,
+                       sizeof(stream->stream_id));
+                stream->send_timestamp_us = stream->state.header.send_timestamp_us;
+        }
+
+        memcpy(stream->state.header.message_id, stream->stream_id,
+               sizeof(stream->stream_id));
+        stream->state.header.send_timestamp_us = stream->send_timestamp_us;
+        stream->state.header.generation = stream->generation;
+        stream->state.header.flags = STROKKUR_CHUNK_STREAM;
+        if (last) {
+                stream->state.header.flags |= STROKKUR_CHUNK_STREAM_LAST;
+        }
+
+        if (stream->checksum) {
+                strokkur_send_checksum(&stream->state);
+        }
+
+        strokkur_sha256_update(&stream->hash, data, n_bytes);
+        strokkur_sha256_final(&stream->hash, stream->state.header.hash);
+        stream->generation_bytes = n_bytes;
+        stream->in_generation = true;
+        return 0;
+}
+
+static void
+finish_generation(struct strokkur_stream_send *stream)
+{
+
+        if (stream->src_fd >= 0) {
+                /* Keep the lookahead byte, if any. */
+                stream->buf_fill -= stream->generation_bytes;
+                memmove(stream->buf, stream->buf + stream->generation_bytes,
+                        stream->buf_fill);
+        } else {
+                stream->offset += stream->generation_bytes;
+        }
+
+        if ((stream->state.header.flags & STROKKUR_CHUNK_STREAM_LAST) != 0) {
+                stream->done = true;
+        }
+
+        stream->in_generation = false;
+        stream->generation++;
+        return;
+}
+
+int
+strokkur_stream_send_pump(struct strokkur_stream_send *stream)
+{
+        int r;
+
+        if (stream->done) {
+                return 0;
+        }
+
+        if (!stream->in_generation) {
+                r = start_generation(stream);
+                if (r != 0) {
+                        return r;
+                }
+        }
+
+        r = strokkur_send_pump(&stream->state);
+        if (r != 0) {
+                return r;
+        }
+
+        finish_generation(stream);
+        return stream->done ? 0 : 1;
+}
+
+int
+strokkur_stream_recv_init(struct strokkur_stream_recv *stream,
+                          struct strokkur_recv_state *window, size_t window_size,
+                          const struct sockaddr_storage *source,
+                          const struct strokkur_chunk *chunk)
+{
+
+        memset(stream, 0, sizeof(*stream));
+        if ((chunk->header.flags & STROKKUR_CHUNK_STREAM) == 0) {
+                return -1;
+        }
+
+        if (window_size == 0) {
+                return -2;
+        }
+
+        memcpy(&stream->source, source, sizeof(stream->source));
+        memcpy(stream->stream_id, chunk->header.message_id,
+               sizeof(stream->stream_id));
+        stream->send_timestamp_us = chunk->header.send_timestamp_us;
+        stream->window = window;
+        stream->window_size = window_size;
+        for (size_t i = 0; i < window_size; i++) {
+                strokkur_recv_deinit(&window[i]);
+        }
+
+        strokkur_sha256_init(&stream->hash);
+        return 0;
+}
+
+static struct strokkur_recv_state *
+window_slot(const struct strokkur_stream_recv *stream, uint32_t generation)
+{
+
+        return &stream->window[generation % stream->window_size];
+}
+
+int
+strokkur_stream_recv_add_chunk(struct strokkur_stream_recv *stream,
+                               const struct sockaddr_storage *source,
+                               struct strokkur_chunk **chunk_p)
+{
+        const struct strokkur_chunk_header *header = &(*chunk_p)->header;
+        struct strokkur_recv_state *slot;
+        int r;
+
+        if (memcmp(&stream->source, source, sizeof(stream->source)) != 0) {
+                return -1;
+        }
+
+        if (stream->send_timestamp_us != header->send_timestamp_us) {
+                return -2;
+        }
+
+        if (uuid_compare(stream->stream_id, header->message_id) != 0) {
+                return -3;
+        }
+
+        if ((header->flags & STROKKUR_CHUNK_STREAM) == 0) {
+                return -7;
+        }
+
+        /* Already delivered: redundant. */
+        if (stream->done || header->generation < stream->next_generation) {
+                return strokkur_stream_recv_ready(stream) ? 0 : 1;
+        }
+
+        if (header->generation - stream->next_generation >= stream->window_size) {
+                return -8;
+        }
+
+        slot = window_slot(stream, header->generation);
+        if (!strokkur_recv_initialised(slot)) {
+                strokkur_recv_init(slot, source, *chunk_p);
+        } else if (slot->chunk_received >= slot->chunk_count) {
+                /* Full rank, waiting for earlier generations. */
+                return strokkur_stream_recv_ready(stream) ? 0 : 1;
+        }
+
+        r = strokkur_recv_add_chunk(slot, source, chunk_p);
+        if (r < 0) {
+                return r;
+        }
+
+        return strokkur_stream_recv_ready(stream) ? 0 : 1;
+}
+
+bool
+strokkur_stream_recv_ready(const struct strokkur_stream_recv *stream)
+{
+        const struct strokkur_recv_state *slot;
+
+        if (stream->done || stream->failed) {
+                return false;
+        }
+
+        slot = window_slot(stream, stream->next_generation);
+        return (strokkur_recv_initialised(slot) &&
+                slot->generation == stream->next_generation &&
+                slot->chunk_received >= slot->chunk_count);
+}
+
+ssize_t
+strokkur_stream_recv_deliver(struct strokkur_stream_recv *stream,
+                             void *buf, size_t bufsz,
+                             strokkur_chunk_recycle_fn *recycle, void *ctx)
+{
+        struct strokkur_recv_state *slot;
+        uint8_t hash[256 / 8];
+        ssize_t n_bytes;
+
+        if (stream->failed) {
+                return -1;
+        }
+
+        if (!strokkur_stream_recv_ready(stream)) {
+                return -2;
+        }
+
+        slot = window_slot(stream, stream->next_generation);
+        /* The stream hash needs the whole generation. */
+        if (bufsz < slot->message_bytes) {
+                return -3;
+        }
+
+        n_bytes = strokkur_recv_extract(slot, buf, slot->message_bytes);
+        if (n_bytes < 0) {
+                return -4;
+        }
+
+        strokkur_sha256_update(&stream->hash, buf, n_bytes);
+        strokkur_sha256_final(&stream->hash, hash);
+        if (memcmp(hash, slot->hash, sizeof(hash)) != 0) {
+                stream->failed = true;
+                n_bytes = -5;
+        } else {
+                stream->delivered_bytes += n_bytes;
+                stream->done = ((slot->flags & STROKKUR_CHUNK_STREAM_LAST) != 0);
+                stream->next_generation++;
+        }
+
+        strokkur_recv_recycle(slot, recycle, ctx);
+        strokkur_recv_deinit(slot);
+        return n_bytes;
+}
@@ -0,0 +1,156 @@
+#ifndef STROKKUR_STREAM_H
+#define STROKKUR_STREAM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <uuid/uuid.h>
+
+#include "strokkur_recv.h"
+#include "strokkur_send.h"
+#include "strokkur_sha256.h"
+
+/* A generation is at most one regular message (4MB with full chunks). */
+#define STROKKUR_GENERATION_MAX (STROKKUR_CHUNK_MAX * STROKKUR_CHUNK_DATA_MAX)
+
+/*
+ * A stream is a sequence of generations: regular messages that share
+ * the stream's message_id and send timestamp, and are numbered in the
+ * header's generation field.  Each generation's hash covers the stream
+ * from its first byte to the end of that generation, so the last
+ * generation's hash is the hash of the whole stream.
+ *
+ * The sender only keeps one generation in flight.
+ */
+struct strokkur_stream_send {
+        struct strokkur_send_state state;
+        struct sockaddr_storage dst;
+        int fd;
+        size_t redundant_messages;
+        size_t chunk_bytes;
+        bool checksum;
+        uuid_t stream_id;
+        uint64_t send_timestamp_us;
+        uint32_t generation;
+        bool in_generation;
+        bool done;
+        /* Bytes in the generation being sent. */
+        size_t generation_bytes;
+        struct strokkur_sha256 hash;
+
+        /* Memory source. */
+        const uint8_t *data;
+        size_t n_bytes;
+        size_t offset;
+
+        /* File descriptor source, src_fd >= 0. */
+        int src_fd;
+        uint8_t *buf;
+        size_t bufsz;
+        size_t buf_fill;
+        bool eof;
+};
+
+/**
+ * @brief Initialise a stream to squirt @a n_bytes (any size) in @a data
+ * to @a dst via socket @a fd.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_stream_send_init(struct strokkur_stream_send *stream,
+                              int fd, const struct sockaddr_storage *dst,
+                              const void *data, size_t n_bytes,
+                              size_t redundant_messages);
+
+/**
+ * @brief Initialise a stream to squirt everything that can be read
+ * from @a src_fd, until EOF, to @a dst via socket @a fd.
+ *
+ * Generations are staged in @a buf; each is at most @a bufsz - 1
+ * bytes (the last byte is lookahead for EOF), and at most
+ * STROKKUR_CHUNK_MAX chunks.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_stream_send_init_fd(struct strokkur_stream_send *stream,
+                                 int fd, const struct sockaddr_storage *dst,
+                                 int src_fd, void *buf, size_t bufsz,
+                                 size_t redundant_messages);
+
+/**
+ * @brief Use at most @a chunk_bytes of data per datagram, as for
+ * strokkur_send_init_sized, for the rest of the stream.  Smaller
+ * chunks also mean smaller generations.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_stream_send_chunk_bytes(struct strokkur_stream_send *stream, size_t chunk_bytes);
+
+/**
+ * @brief Checksum every chunk of the stream, as strokkur_send_checksum.
+ */
+void strokkur_stream_send_checksum(struct strokkur_stream_send *stream);
+
+/**
+ * @brief Send one chunk of the current generation, reading in the next
+ * generation first if necessary.
+ *
+ * @return as strokkur_send_pump.  Negative with errno EAGAIN if a
+ * non-blocking @a src_fd has no data yet.
+ */
+int strokkur_stream_send_pump(struct strokkur_stream_send *stream);
+
+/*
+ * The receiver keeps a sliding window of receive states, indexed by
+ * generation, and delivers generations in order.  Chunks for
+ * generations past the window are dropped.
+ */
+struct strokkur_stream_recv {
+        struct sockaddr_storage source;
+        uuid_t stream_id;
+        uint64_t send_timestamp_us;
+        struct strokkur_recv_state *window;
+        size_t window_size;
+        uint32_t next_generation;
+        uint64_t delivered_bytes;
+        struct strokkur_sha256 hash;
+        bool done; /* The last generation was delivered. */
+        bool failed; /* A generation did not match the stream hash. */
+};
+
+/**
+ * @brief Initialise a stream receiver for @a source and the stream of
+ * @a chunk, with the @a window_size receive states in @a window.
+ *
+ * @return 0 on success, negative if @a chunk is not part of a stream.
+ */
+int strokkur_stream_recv_init(struct strokkur_stream_recv *stream,
+                              struct strokkur_recv_state *window, size_t window_size,
+                              const struct sockaddr_storage *source,
+                              const struct strokkur_chunk *chunk);
+
+/**
+ * @brief Adjoin a chunk to the stream, as strokkur_recv_add_chunk.
+ *
+ * @return negative on failure (the chunk should still be recycled), 0
+ * if the next generation is ready for delivery, positive otherwise.
+ */
+int strokkur_stream_recv_add_chunk(struct strokkur_stream_recv *stream,
+                                   const struct sockaddr_storage *source,
+                                   struct strokkur_chunk **chunk);
+
+bool strokkur_stream_recv_ready(const struct strokkur_stream_recv *stream);
+
+/**
+ * @brief Decode the next generation into @a buf, check the stream hash
+ * so far, and slide the window.  The generation's chunks are passed to
+ * @a recycle.
+ *
+ * @return negative on failure (including a hash mismatch, after which
+ * the stream is unusable), the size of the generation on success.
+ */
+ssize_t strokkur_stream_recv_deliver(struct strokkur_stream_recv *stream,
+                                     void *buf, size_t bufsz,
+                                     strokkur_chunk_recycle_fn *recycle, void *ctx);
+#endif /* !STROKKUR_STREAM_H */
@@ -0,0 +1,245 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "strokkur_submit.h"
+
+int
+strokkur_submit_init(struct strokkur_submit_queue *queue,
+                     struct strokkur_submit_cell *cells, size_t n_cells,
+                     struct strokkur_send_state **active, size_t max_active)
+{
+
+        memset(queue, 0, sizeof(*queue));
+        queue->eventfd = -1;
+        if (n_cells == 0 || (n_cells & (n_cells - 1)) != 0) {
+                return -1;
+        }
+
+        if (max_active == 0) {
+                return -2;
+        }
+
+#ifdef __linux__
+        queue->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+        if (queue->eventfd < 0) {
+                return -3;
+        }
+
+        for (size_t i = 0; i < n_cells; i++) {
+                cells[i].sequence = i;
+                cells[i].state = NULL;
+        }
+
+        queue->cells = cells;
+        queue->mask = n_cells - 1;
+        queue->active = active;
+        queue->max_active = max_active;
+        return 0;
+}
+
+void
+strokkur_submit_deinit(struct strokkur_submit_queue *queue)
+{
+
+        if (queue->eventfd >= 0) {
+                close(queue->eventfd);
+        }
+
+        memset(queue, 0, sizeof(*queue));
+        queue->eventfd = -1;
+        return;
+}
+
+int
+strokkur_submit_fd(const struct strokkur_submit_queue *queue)
+{
+
+        return queue->eventfd;
+}
+
+static int
+wake_consumer(struct strokkur_submit_queue *queue)
+{
+        uint64_t one = 1;
+
+        /* Pairs with the fence in consumer_idle. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&queue->armed, __ATOMIC_RELAXED) == 0 ||
+            __atomic_exchange_n(&queue->armed, 0, __ATOMIC_RELAXED) == 0) {
+                return 0;
+        }
+
+        if (write(queue->eventfd, &one, sizeof(one)) < 0) {
+                /* EAGAIN means the counter is already non-zero, i.e., readable. */
+                return (errno == EAGAIN) ? 0 : -1;
+        }
+
+        return 0;
+}
+
+int
+strokkur_submit(struct strokkur_submit_queue *queue,
+                struct strokkur_send_state *state)
+{
+        struct strokkur_submit_cell *cell;
+        uint64_t pos;
+
+        pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        for (;;) {
+                uint64_t sequence;
+                int64_t diff;
+
+                cell = &queue->cells[pos & queue->mask];
+                sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+                diff = (int64_t)(sequence - pos);
+                if (diff == 0) {
+                        if (__atomic_compare_exchange_n(&queue->tail, &pos, pos + 1,
+                                                        true, __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+                                break;
+                        }
+                } else if (diff < 0) {
+                        /* The consumer has yet to free this cell. */
+                        return -1;
+                } else {
+                        pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+                }
+        }
+
+        cell->state = state;
+        __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+        if (wake_consumer(queue) != 0) {
+                return -2;
+        }
+
+        return 0;
+}
+
+static struct strokkur_send_state *
+dequeue(struct strokkur_submit_queue *queue)
+{
+        struct strokkur_submit_cell *cell = &queue->cells[queue->head & queue->mask];
+        struct strokkur_send_state *state;
+
+        if (__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != queue->head + 1) {
+                return NULL;
+        }
+
+        state = cell->state;
+        __atomic_store_n(&cell->sequence, queue->head + queue->mask + 1,
+                         __ATOMIC_RELEASE);
+        queue->head++;
+        return state;
+}
+
+/*
+ * Ask producers for a wakeup, then check that nothing slipped in
+ * before they could see the request.
+ */
+static bool
+consumer_idle(struct strokkur_submit_queue *queue)
+{
+        const struct strokkur_submit_cell *cell = &queue->cells[queue->head & queue->mask];
+
+        __atomic_store_n(&queue->armed, 1, __ATOMIC_RELAXED);
+        queue->drain = true;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        return __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) != queue->head + 1;
+}
+
+/* Disarm the wakeup, and consume any wakeup that producers sent. */
+static int
+consumer_wake(struct strokkur_submit_queue *queue)
+{
+        uint64_t count;
+
+        __atomic_store_n(&queue->armed, 0, __ATOMIC_RELAXED);
+        queue->drain = false;
+        if (read(queue->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                return -1;
+        }
+
+        return 0;
+}
+
+static bool
+transient_error(int r)
+{
+
+        return r == -1 &&
+                (errno == EAGAIN || errno == EWOULDBLOCK ||
+                 errno == ENOBUFS || errno == EINTR);
+}
+
+int
+strokkur_submit_pump(struct strokkur_submit_queue *queue,
+                     strokkur_send_done_fn *done, void *ctx)
+{
+
+        for (;;) {
+                size_t n_waiting = 0;
+
+                /* Producers only write to the eventfd after consumer_idle. */
+                if (queue->drain && consumer_wake(queue) != 0) {
+                        return -2;
+                }
+
+                while (queue->n_active < queue->max_active) {
+                        struct strokkur_send_state *state = dequeue(queue);
+
+                        if (state == NULL) {
+                                break;
+                        }
+
+                        queue->active[queue->n_active++] = state;
+                }
+
+                for (size_t i = 0; i < queue->n_active;) {
+                        struct strokkur_send_state *state = queue->active[i];
+                        int r = 1;
+
+                        for (size_t burst = 0; burst < STROKKUR_SUBMIT_BURST && r == 1; burst++) {
+                                r = strokkur_send_pump(state);
+                        }
+
+                        if (transient_error(r)) {
+                                return -1;
+                        }
+
+                        if (r == 1 || r == 2) {
+                                n_waiting += r == 2;
+                                i++;
+                                continue;
+                        }
+
+                        queue->active[i] = queue->active[--queue->n_active];
+                        done(ctx, state, r);
+                }
+
+                if (queue->n_active > n_waiting) {
+                        return queue->n_active;
+                }
+
+                /*
+                 * Pumping states that wait on zero-copy completions
+                 * would spin: take new submissions if there is room,
+                 * else let the caller wait for the completions.
+                 */
+                if (queue->n_active > 0 && queue->n_active == queue->max_active) {
+                        return -3;
+                }
+
+                if (consumer_idle(queue)) {
+                        return queue->n_active > 0 ? -3 : 0;
+                }
+        }
+}
@@ -0,0 +1,100 @@
+#ifndef STROKKUR_SUBMIT_H
+#define STROKKUR_SUBMIT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strokkur_send.h"
+
+/* Pump each active state at most this many times per round. */
+#define STROKKUR_SUBMIT_BURST 16
+
+struct strokkur_submit_cell {
+        uint64_t sequence;
+        struct strokkur_send_state *state;
+};
+
+/* Hands a finished state back to its owner, with a negative result on failure. */
+typedef void strokkur_send_done_fn(void *ctx, struct strokkur_send_state *state, int result);
+
+/*
+ * A bounded lock-free multi-producer, single-consumer queue of
+ * initialised send states, for application threads that share one
+ * socket with an I/O thread.  Producers only contend on one atomic
+ * counter; the I/O thread waits for the queue's eventfd, and only
+ * gets woken up when it might be asleep.
+ */
+struct strokkur_submit_queue {
+        /* Producers. */
+        uint64_t tail __attribute__((__aligned__(64)));
+        /* Set by the consumer when it runs out of work. */
+        uint32_t armed __attribute__((__aligned__(64)));
+
+        /* Consumer. */
+        uint64_t head __attribute__((__aligned__(64)));
+        /* Armed since the last read of the eventfd. */
+        bool drain;
+        struct strokkur_send_state **active;
+        size_t n_active;
+        size_t max_active;
+
+        /* Read-only after init. */
+        int eventfd __attribute__((__aligned__(64)));
+        struct strokkur_submit_cell *cells;
+        size_t mask;
+};
+
+/**
+ * @brief Initialise an empty submission queue with the @a n_cells
+ * (a power of two) cells in @a cells, and room for @a max_active
+ * states in flight in @a active.
+ *
+ * @return 0 on success, negative on failure (e.g., eventfd is not
+ * available).
+ */
+int strokkur_submit_init(struct strokkur_submit_queue *queue,
+                         struct strokkur_submit_cell *cells, size_t n_cells,
+                         struct strokkur_send_state **active, size_t max_active);
+
+/**
+ * @brief Close the queue's eventfd.  Any state still in the queue is
+ * abandoned.
+ */
+void strokkur_submit_deinit(struct strokkur_submit_queue *queue);
+
+/**
+ * @brief Return the file descriptor the I/O thread should poll for
+ * reads: it becomes readable when states are submitted to an idle
+ * queue.
+ */
+int strokkur_submit_fd(const struct strokkur_submit_queue *queue);
+
+/**
+ * @brief Enqueue the initialised send state @a state, from any thread.
+ *
+ * The state belongs to the I/O thread until it is passed to the done
+ * callback of strokkur_submit_pump.
+ *
+ * @return 0 on success, -1 if the queue is full, -2 (with errno) if
+ * the state was queued but waking up the I/O thread failed.
+ */
+int strokkur_submit(struct strokkur_submit_queue *queue, struct strokkur_send_state *state);
+
+/**
+ * @brief Move submitted states to the active set, then pump every
+ * active state (at most STROKKUR_SUBMIT_BURST chunks each).  Only the
+ * I/O thread may call this.
+ *
+ * States that complete or fail are passed to @a done.  States waiting
+ * on zero-copy completions (strokkur_send_pump returned 2) stay active.
+ *
+ * @return the number of active states, if any can make progress; 0
+ * once idle (poll the queue's fd); -3 if every active state waits on
+ * zero-copy completions (poll the socket for POLLERR and drain its
+ * error queue, and the queue's fd for new submissions); -1 with errno
+ * EAGAIN (or ENOBUFS) if the socket is full (poll it for writes); or
+ * -2 with errno if reading the eventfd failed.
+ */
+int strokkur_submit_pump(struct strokkur_submit_queue *queue,
+                         strokkur_send_done_fn *done, void *ctx);
+#endif /* !STROKKUR_SUBMIT_H */
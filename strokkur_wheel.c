@@ -0,0 +1,223 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "strokkur_list.h"
+#include "strokkur_wheel.h"
+
+#define LEVEL_SHIFT(LEVEL) ((LEVEL) * STROKKUR_WHEEL_SLOT_BITS)
+#define SLOT_MASK (STROKKUR_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << LEVEL_SHIFT(STROKKUR_WHEEL_LEVELS))
+#define WHEEL_LINK STROKKUR_LINK(wheel_link)
+#define BUDGET_LINK STROKKUR_LINK(budget_link)
+
+int
+strokkur_wheel_init(struct strokkur_wheel *wheel,
+                    uint64_t timeout_us, uint64_t tick_us)
+{
+
+        memset(wheel, 0, sizeof(*wheel));
+        if (tick_us == 0) {
+                return -1;
+        }
+
+        wheel->timeout_us = timeout_us;
+        wheel->tick_us = tick_us;
+        wheel->now_tick = strokkur_clock_us() / tick_us;
+        return 0;
+}
+
+static uint64_t
+deadline_tick(const struct strokkur_wheel *wheel,
+              const struct strokkur_recv_state *state)
+{
+
+        return (state->deadline_us + wheel->tick_us - 1) / wheel->tick_us;
+}
+
+/*
+ * Find the lowest level whose span covers the state's deadline, and
+ * link the state in the slot for that deadline, or for @a min_tick if
+ * the deadline is earlier.  Deadlines past the last level are clamped,
+ * and re-placed when they reach level 0.
+ */
+static void
+place_state(struct strokkur_wheel *wheel, struct strokkur_recv_state *state,
+            uint64_t min_tick)
+{
+        uint64_t tick = deadline_tick(wheel, state);
+        uint64_t delta;
+        size_t level = 0;
+        size_t slot;
+
+        if (tick < min_tick) {
+                tick = min_tick;
+        }
+
+        delta = tick - wheel->now_tick;
+        if (delta >= WHEEL_SPAN) {
+                delta = WHEEL_SPAN - 1;
+                tick = wheel->now_tick + delta;
+        }
+
+        while (level + 1 < STROKKUR_WHEEL_LEVELS &&
+               delta >= (1ULL << LEVEL_SHIFT(level + 1))) {
+                level++;
+        }
+
+        slot = (tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        strokkur_list_insert(&wheel->slots[level][slot], state, WHEEL_LINK);
+        wheel->occupied[level] |= 1ULL << slot;
+        return;
+}
+
+void
+strokkur_wheel_insert(struct strokkur_wheel *wheel,
+                      struct strokkur_recv_state *state)
+{
+
+        assert(!strokkur_list_linked(state, WHEEL_LINK));
+        state->deadline_us = state->first_received_us + wheel->timeout_us;
+        /* The current slot has already been expired. */
+        place_state(wheel, state, wheel->now_tick + 1);
+        wheel->count++;
+        return;
+}
+
+void
+strokkur_wheel_remove(struct strokkur_wheel *wheel,
+                      struct strokkur_recv_state *state)
+{
+
+        if (!strokkur_list_linked(state, WHEEL_LINK)) {
+                return;
+        }
+
+        /* The slot's occupied bit is cleared lazily. */
+        strokkur_list_remove(state, WHEEL_LINK);
+        wheel->count--;
+        return;
+}
+
+/* Move the list in a slot to the caller's @a head. */
+static void
+detach_slot(struct strokkur_wheel *wheel, size_t level, size_t slot,
+            struct strokkur_recv_state **head)
+{
+
+        strokkur_list_move(&wheel->slots[level][slot], head, WHEEL_LINK);
+        wheel->occupied[level] &= ~(1ULL << slot);
+        return;
+}
+
+/*
+ * Redistribute the current slot of every level whose period just
+ * wrapped around, from the highest level down.
+ */
+static void
+cascade(struct strokkur_wheel *wheel)
+{
+        size_t top = 1;
+
+        while (top < STROKKUR_WHEEL_LEVELS &&
+               (wheel->now_tick & ((1ULL << LEVEL_SHIFT(top)) - 1)) == 0) {
+                top++;
+        }
+
+        for (size_t level = top; level --> 1;) {
+                size_t slot = (wheel->now_tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+                struct strokkur_recv_state *head;
+
+                detach_slot(wheel, level, slot, &head);
+                while (head != NULL) {
+                        struct strokkur_recv_state *state = head;
+
+                        strokkur_list_remove(state, WHEEL_LINK);
+                        /* The current level 0 slot is expired next. */
+                        place_state(wheel, state, wheel->now_tick);
+                }
+        }
+
+        return;
+}
+
+static size_t
+expire_slot(struct strokkur_wheel *wheel, size_t slot,
+            strokkur_chunk_recycle_fn *recycle,
+            strokkur_wheel_expired_fn *expired, void *ctx)
+{
+        struct strokkur_recv_state *head;
+        size_t ret = 0;
+
+        detach_slot(wheel, 0, slot, &head);
+        while (head != NULL) {
+                struct strokkur_recv_state *state = head;
+
+                strokkur_list_remove(state, WHEEL_LINK);
+                if (deadline_tick(wheel, state) > wheel->now_tick) {
+                        /* Clamped deadline. */
+                        place_state(wheel, state, wheel->now_tick + 1);
+                        continue;
+                }
+
+                wheel->count--;
+                ret++;
+                strokkur_recv_recycle(state, recycle, ctx);
+                if (expired != NULL) {
+                        expired(ctx, state);
+                } else {
+                        /* Without a callback, nothing releases it from a budget. */
+                        assert(!strokkur_list_linked(state, BUDGET_LINK));
+                        strokkur_recv_deinit(state);
+                }
+        }
+
+        return ret;
+}
+
+size_t
+strokkur_wheel_expire(struct strokkur_wheel *wheel, uint64_t now_us,
+                      strokkur_chunk_recycle_fn *recycle,
+                      strokkur_wheel_expired_fn *expired, void *ctx)
+{
+        uint64_t target = now_us / wheel->tick_us;
+        size_t ret = 0;
+
+        while (wheel->now_tick < target) {
+                uint64_t next = wheel->now_tick + 1;
+                uint64_t boundary = (wheel->now_tick | SLOT_MASK) + 1;
+
+                if (wheel->count == 0) {
+                        wheel->now_tick = target;
+                        break;
+                }
+
+                /* Skip to the next non-empty level 0 slot or cascade. */
+                if (next < boundary) {
+                        uint64_t pending;
+
+                        pending = wheel->occupied[0] >> (next & SLOT_MASK);
+                        if (pending == 0) {
+                                next = boundary;
+                        } else {
+                                next += __builtin_ctzll(pending);
+                        }
+                }
+
+                if (next > target) {
+                        wheel->now_tick = target;
+                        break;
+                }
+
+                wheel->now_tick = next;
+                if ((next & SLOT_MASK) == 0) {
+                        cascade(wheel);
+                }
+
+                ret += expire_slot(wheel, next & SLOT_MASK,
+                                   recycle, expired, ctx);
+        }
+
+        return ret;
+}
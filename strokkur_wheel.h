@@ -0,0 +1,78 @@
+#ifndef STROKKUR_WHEEL_H
+#define STROKKUR_WHEEL_H
+#include <stddef.h>
+#include <stdint.h>
+
+#include "strokkur_recv.h"
+
+/* Each level of the wheel has 64 slots, i.e., 6 bits of the deadline. */
+#define STROKKUR_WHEEL_SLOT_BITS 6
+#define STROKKUR_WHEEL_SLOTS (1UL << STROKKUR_WHEEL_SLOT_BITS)
+/* 4 levels cover 2^24 ticks, more than 4 hours at 1ms. */
+#define STROKKUR_WHEEL_LEVELS 4
+
+/*
+ * A hierarchical timer wheel of receive states, keyed on
+ * first_received_us + timeout_us.  States are linked intrusively, so
+ * the wheel never allocates; each state is cascaded at most
+ * STROKKUR_WHEEL_LEVELS times before it expires.
+ */
+struct strokkur_wheel {
+        uint64_t timeout_us;
+        uint64_t tick_us;
+        uint64_t now_tick;
+        size_t count;
+        /* Bit i is set if slot i *may* be non-empty. */
+        uint64_t occupied[STROKKUR_WHEEL_LEVELS];
+        struct strokkur_recv_state *slots[STROKKUR_WHEEL_LEVELS][STROKKUR_WHEEL_SLOTS];
+};
+
+/**
+ * @brief Called for each expired receive state, after its chunks have
+ * been recycled.  The state is unlinked from the wheel and belongs to
+ * the callee, which should release it from any strokkur_budget, then
+ * deinitialise or reuse it.
+ *
+ * @note the callback is required for states that are also admitted to
+ * a strokkur_budget: without it, expired states are deinitialised
+ * while still linked in the budget (an assertion).
+ */
+typedef void strokkur_wheel_expired_fn(void *ctx, struct strokkur_recv_state *);
+
+/**
+ * @brief Initialise an empty wheel that expires receive states
+ * @a timeout_us after their first chunk, with a resolution of
+ * @a tick_us.
+ *
+ * @return 0 on success, negative on failure.
+ */
+int strokkur_wheel_init(struct strokkur_wheel *, uint64_t timeout_us, uint64_t tick_us);
+
+/**
+ * @brief Track an initialised receive state in the wheel.
+ *
+ * @note the state must be removed before it is re-initialised or
+ * deinitialised.
+ */
+void strokkur_wheel_insert(struct strokkur_wheel *, struct strokkur_recv_state *);
+
+/**
+ * @brief Stop tracking a receive state, e.g., once its message has
+ * been extracted.  Removing an unlinked state is a no-op.
+ */
+void strokkur_wheel_remove(struct strokkur_wheel *, struct strokkur_recv_state *);
+
+/**
+ * @brief Expire every receive state whose deadline is at or before
+ * @a now_us.
+ *
+ * Each expired state's chunks are passed to @a recycle, and the state
+ * is then passed to @a expired, or deinitialised if @a expired is NULL
+ * (only for states not in a strokkur_budget).
+ *
+ * @return the number of expired states.
+ */
+size_t strokkur_wheel_expire(struct strokkur_wheel *, uint64_t now_us,
+                             strokkur_chunk_recycle_fn *recycle,
+                             strokkur_wheel_expired_fn *expired, void *ctx);
+#endif /* !STROKKUR_WHEEL_H */
@@ -0,0 +1,143 @@
+/*
+ * Fan-out with MTU-sized chunks, over loopback: every destination
+ * must decode the message from datagrams that fit a 1500 byte MTU.
+ *
+ *   cc -std=gnu11 -I.. fanout_sized.c ../strokkur_*.c -luuid
+ */
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "strokkur.h"
+
+#define N_DESTS 4
+#define N_CHUNKS 1024
+#define MESSAGE_BYTES 300000
+
+static struct strokkur_chunk pool[N_CHUNKS];
+static struct strokkur_chunk *free_chunks[N_CHUNKS];
+static size_t n_free;
+
+static void
+recycle(void *ctx, struct strokkur_chunk *chunk)
+{
+
+        (void)ctx;
+        free_chunks[n_free++] = chunk;
+        return;
+}
+
+static int
+open_receiver(struct sockaddr_storage *dst)
+{
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int buf_bytes = 16 << 20;
+        int fd;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(fd >= 0);
+        (void)setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_bytes, sizeof(buf_bytes));
+        assert(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+        assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        assert(getsockname(fd, (struct sockaddr *)&addr, &addr_len) == 0);
+        memset(dst, 0, sizeof(*dst));
+        memcpy(dst, &addr, sizeof(addr));
+        return fd;
+}
+
+static void
+receive(int fd, const uint8_t *message, size_t chunk_bytes)
+{
+        static struct strokkur_recv_state state;
+        static uint8_t out[MESSAGE_BYTES];
+        struct sockaddr_storage source;
+        bool initialised = false;
+
+        memset(&state, 0, sizeof(state));
+        for (;;) {
+                struct strokkur_chunk *chunk = free_chunks[--n_free];
+
+                if (strokkur_recv_chunk(fd, &source, chunk) != 0) {
+                        n_free++;
+                        break;
+                }
+
+                assert(chunk->header.chunk_stride == chunk_bytes);
+                assert(8 + sizeof(chunk->header) + chunk->header.chunk_bytes <= 1500 - 20);
+                if (!initialised) {
+                        strokkur_recv_init(&state, &source, chunk);
+                        initialised = true;
+                }
+
+                assert(strokkur_recv_add_chunk(&state, &source, &chunk) >= 0);
+                if (chunk != NULL) {
+                        recycle(NULL, chunk);
+                }
+        }
+
+        assert(strokkur_recv_extract(&state, out, sizeof(out)) == MESSAGE_BYTES);
+        assert(memcmp(out, message, MESSAGE_BYTES) == 0);
+        strokkur_recv_recycle(&state, recycle, NULL);
+        strokkur_recv_deinit(&state);
+        return;
+}
+
+static void
+test_fanout(size_t chunk_bytes)
+{
+        static struct strokkur_fanout_dest dests[N_DESTS];
+        static struct strokkur_fanout fanout;
+        static uint8_t message[MESSAGE_BYTES];
+        int fds[N_DESTS];
+        int fd, r;
+
+        for (size_t i = 0; i < sizeof(message); i++) {
+                message[i] = rand();
+        }
+
+        for (size_t i = 0; i < N_DESTS; i++) {
+                fds[i] = open_receiver(&dests[i].dst);
+        }
+
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        assert(fd >= 0);
+        assert(strokkur_fanout_init_sized(&fanout, fd, dests, N_DESTS,
+                                          message, sizeof(message), 4,
+                                          chunk_bytes) == 0);
+        do {
+                r = strokkur_fanout_pump(&fanout);
+        } while (r == 1);
+
+        assert(r == 0 && fanout.errors == 0);
+        for (size_t i = 0; i < N_DESTS; i++) {
+                receive(fds[i], message, chunk_bytes);
+                close(fds[i]);
+        }
+
+        close(fd);
+        return;
+}
+
+int
+main(void)
+{
+
+        for (size_t i = 0; i < N_CHUNKS; i++) {
+                free_chunks[n_free++] = &pool[i];
+        }
+
+        test_fanout(STROKKUR_CHUNK_DATA_MTU1500);
+        test_fanout(STROKKUR_CHUNK_DATA_MTU1500_IPV6);
+        printf("ok\n");
+        return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * MSG_ZEROCOPY completion tracking, without a socket: completions are
+ * fed to strokkur_zerocopy_note_event out of order and in pieces.
+ *
+ *   cc -std=gnu11 -I.. zerocopy_completions.c ../strokkur_*.c -luuid
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "strokkur_send.h"
+
+static void
+note(struct strokkur_zerocopy *zerocopy, uint32_t lo, uint32_t hi)
+{
+        struct strokkur_send_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.type = STROKKUR_SEND_EVENT_ZEROCOPY;
+        event.zerocopy_lo = lo;
+        event.zerocopy_hi = hi;
+        assert(strokkur_zerocopy_note_event(zerocopy, &event) == 0);
+        return;
+}
+
+/* Pretend @a n_sends zero-copy sends are in flight, from @a first. */
+static void
+start(struct strokkur_zerocopy *zerocopy, uint32_t first, uint32_t n_sends)
+{
+
+        memset(zerocopy, 0, sizeof(*zerocopy));
+        zerocopy->completed = first;
+        zerocopy->next_id = first + n_sends;
+        return;
+}
+
+static void
+test_adjacent(void)
+{
+        struct strokkur_zerocopy zerocopy;
+
+        start(&zerocopy, 0, 20);
+        note(&zerocopy, 5, 9);
+        note(&zerocopy, 10, 19);
+        assert(zerocopy.completed == 0);
+        note(&zerocopy, 0, 4);
+        assert(zerocopy.completed == 20);
+        return;
+}
+
+static void
+test_overlapping(void)
+{
+        struct strokkur_zerocopy zerocopy;
+
+        start(&zerocopy, 100, 50);
+        note(&zerocopy, 120, 140);
+        note(&zerocopy, 110, 125);
+        note(&zerocopy, 135, 149);
+        assert(zerocopy.completed == 100);
+        note(&zerocopy, 100, 112);
+        assert(zerocopy.completed == 150);
+        /* Stale and duplicate completions are harmless. */
+        note(&zerocopy, 90, 149);
+        note(&zerocopy, 100, 100);
+        assert(zerocopy.completed == 150);
+        return;
+}
+
+/* One completion per send, in a scrambled order: far more than 16 gaps. */
+static void
+test_pieces(uint32_t first)
+{
+        const uint32_t n_sends = STROKKUR_ZEROCOPY_WINDOW - 1;
+        struct strokkur_zerocopy zerocopy;
+        struct strokkur_send_state state;
+        uint32_t order[STROKKUR_ZEROCOPY_WINDOW];
+        uint32_t seed = 12345;
+
+        for (uint32_t i = 0; i < n_sends; i++) {
+                order[i] = i;
+        }
+
+        for (uint32_t i = n_sends - 1; i > 0; i--) {
+                uint32_t j, tmp;
+
+                seed = seed * 1103515245 + 12345;
+                j = (seed >> 8) % (i + 1);
+                tmp = order[i];
+                order[i] = order[j];
+                order[j] = tmp;
+        }
+
+        start(&zerocopy, first, n_sends);
+        memset(&state, 0, sizeof(state));
+        state.zerocopy = &zerocopy;
+        state.zerocopy_sent = n_sends;
+        state.zerocopy_last = first + n_sends - 1;
+        for (uint32_t i = 0; i < n_sends; i++) {
+                assert(!strokkur_send_released(&state));
+                note(&zerocopy, first + order[i], first + order[i]);
+        }
+
+        assert(zerocopy.completed == first + n_sends);
+        assert(strokkur_send_released(&state));
+        return;
+}
+
+int
+main(void)
+{
+
+        test_adjacent();
+        test_overlapping();
+        test_pieces(0);
+        /* The kernel's ids are 32 bits and wrap around. */
+        test_pieces(UINT32_MAX - 100);
+        printf("ok\n");
+        return 0;
+}